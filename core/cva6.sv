@@ -19,7 +19,7 @@ import "DPI-C" function void dromajo_step(int     hart_id,
                                           longint pc,
                                           int     insn,
                                           longint wdata, longint cycle);
-import "DPI-C" function void init_dromajo(string cfg_f_name);
+import "DPI-C" function void init_dromajo(string cfg_f_name, string args, int unsigned run_on);
 `endif
 
 
@@ -846,8 +846,14 @@ module cva6 import ariane_pkg::*; #(
 `ifdef DROMAJO
   initial begin
     string f_name;
+    string args = "";
+    int unsigned run_on = 0;
+    // extra options for dromajo, and how many instructions to keep going
+    // after a mismatch to see the waveform activity that follows it
+    void'($value$plusargs("dromajo_args=%s", args));
+    void'($value$plusargs("dromajo_run_on=%d", run_on));
     if ($value$plusargs("checkpoint=%s", f_name)) begin
-      init_dromajo({f_name, ".cfg"});
+      init_dromajo({f_name, ".cfg"}, args, run_on);
       $display("Done initing dromajo...");
     end else begin
       $display("Failed initing dromajo. Provide checkpoint name.");
@@ -860,31 +866,81 @@ module cva6 import ariane_pkg::*; #(
   end
 
 `ifdef DROMAJO
-  always_ff @(posedge clk_i) begin
-      for (int i = 0; i < NR_COMMIT_PORTS; i++) begin
-        if (commit_instr_id_commit[i].ex.valid) begin
-          dromajo_trap(hart_id_i,
-                       commit_instr_id_commit[i].ex.cause);
-        end
-      end
+  // Commits and traps are collected in commit order and handed to Dromajo
+  // in batches of up to +dromajo_batch=<n> records (1 validates every cycle).
+  // Dromajo models shared memory by interleaving the harts' commits, so with
+  // more than one hart the batch defaults to 1. The pending records are
+  // flushed after +dromajo_timeout=<n> cycles without a commit (a hart
+  // sitting in wfi) and at the end of the simulation.
+  // The records are kept as parallel arrays of plain 32/64-bit values, which
+  // every simulator passes to C as int/long long arrays.
+  localparam int unsigned DromajoBatchMax = 256;
+  import "DPI-C" function void dromajo_step_n(input int     hart_id,
+                                              input int     is_trap [DromajoBatchMax],
+                                              input longint pc      [DromajoBatchMax],
+                                              input int     insn    [DromajoBatchMax],
+                                              input longint wdata   [DromajoBatchMax],
+                                              input longint cycle   [DromajoBatchMax],
+                                              input int unsigned n);
+  import "DPI-C" function int unsigned dromajo_num_harts();
+  int     dromajo_is_trap [DromajoBatchMax];
+  longint dromajo_pc      [DromajoBatchMax];
+  int     dromajo_insn    [DromajoBatchMax];
+  longint dromajo_wdata   [DromajoBatchMax]; // trap cause for traps
+  longint dromajo_cycle   [DromajoBatchMax];
+  int unsigned dromajo_count = 0;
+  int unsigned dromajo_batch = 64;
+  bit          dromajo_batch_set = 0;
+  int unsigned dromajo_timeout = 1000;
+  int unsigned dromajo_idle = 0;
+
+  initial begin
+    dromajo_batch_set = $value$plusargs("dromajo_batch=%d", dromajo_batch);
+    void'($value$plusargs("dromajo_timeout=%d", dromajo_timeout));
+    if (dromajo_batch == 0) dromajo_batch = 1;
+    if (dromajo_batch > DromajoBatchMax - NR_COMMIT_PORTS)
+      dromajo_batch = DromajoBatchMax - NR_COMMIT_PORTS;
   end
 
   always_ff @(posedge clk_i) begin
+    // every hart called init_dromajo from an initial block by now
+    if (!dromajo_batch_set) begin
+      if (dromajo_num_harts() > 1) dromajo_batch = 1;
+      dromajo_batch_set = 1;
+    end
+    dromajo_idle++;
     for (int i = 0; i < NR_COMMIT_PORTS; i++) begin
-      if (commit_ack[i] && !commit_instr_id_commit[i].ex.valid) begin
-        if (csr_op_commit_csr == 0) begin
-          dromajo_step(hart_id_i,
-                       commit_instr_id_commit[i].pc,
-                       commit_instr_id_commit[i].ex.tval[31:0],
-                       commit_instr_id_commit[i].result, cycles);
-        end else begin
-          dromajo_step(hart_id_i,
-                       commit_instr_id_commit[i].pc,
-                       commit_instr_id_commit[i].ex.tval[31:0],
-                       csr_rdata_csr_commit, cycles);
-        end
+      if (commit_instr_id_commit[i].ex.valid) begin
+        dromajo_is_trap[dromajo_count] = 1;
+        dromajo_pc[dromajo_count]      = commit_instr_id_commit[i].pc;
+        dromajo_insn[dromajo_count]    = 0;
+        dromajo_wdata[dromajo_count]   = commit_instr_id_commit[i].ex.cause;
+        dromajo_cycle[dromajo_count]   = cycles;
+        dromajo_count++;
+        dromajo_idle = 0;
+      end else if (commit_ack[i]) begin
+        dromajo_is_trap[dromajo_count] = 0;
+        dromajo_pc[dromajo_count]      = commit_instr_id_commit[i].pc;
+        dromajo_insn[dromajo_count]    = commit_instr_id_commit[i].ex.tval[31:0];
+        dromajo_wdata[dromajo_count]   = (csr_op_commit_csr == 0) ? commit_instr_id_commit[i].result
+                                                                  : csr_rdata_csr_commit;
+        dromajo_cycle[dromajo_count]   = cycles;
+        dromajo_count++;
+        dromajo_idle = 0;
       end
     end
+    if (dromajo_count >= dromajo_batch ||
+        (dromajo_count != 0 && dromajo_idle >= dromajo_timeout)) begin
+      dromajo_step_n(hart_id_i, dromajo_is_trap, dromajo_pc, dromajo_insn,
+                     dromajo_wdata, dromajo_cycle, dromajo_count);
+      dromajo_count = 0;
+    end
+  end
+
+  final begin
+    if (dromajo_count != 0)
+      dromajo_step_n(hart_id_i, dromajo_is_trap, dromajo_pc, dromajo_insn,
+                     dromajo_wdata, dromajo_cycle, dromajo_count);
   end
 `endif
 
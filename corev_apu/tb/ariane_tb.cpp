@@ -19,22 +19,29 @@
 #include "verilator.h"
 #include "verilated.h"
 #include "verilated_vcd_c.h"
+#if VM_SAVABLE
+#include "verilated_save.h"
+#endif
 #include "Variane_testharness__Dpi.h"
 
 #include <stdio.h>
 #include <iostream>
 #include <iomanip>
 #include <string>
+#include <vector>
 #include <getopt.h>
 #include <chrono>
 #include <ctime>
 #include <signal.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <fesvr/dtm.h>
-#include <fesvr/htif_hexwriter.h>
-#include <fesvr/elfloader.h>
+#include <fesvr/elf.h>
 #include "remote_bitbang.h"
+#include "sim_perf.h"
 
 // This software is heavily based on Rocket Chip
 // Checkout this awesome project:
@@ -47,20 +54,88 @@ static vluint64_t main_time = 0;
 
 static const char *verilog_plusargs[] = {"jtag_rbb_enable", "time_out", "debug_disable"};
 
+// main memory array of the verilated SRAM and where it sits in the memory map
+#define MAIN_MEM top->ariane_testharness__DOT__i_sram__DOT__gen_cut__BRA__0__KET____DOT__gen_mem__DOT__i_ram__DOT__Mem_DP
+static const uint64_t main_mem_base = 0x80000000;
+
 #ifndef DROMAJO
 extern dtm_t* dtm;
+extern bool dtm_idle();
 extern remote_bitbang_t * jtag;
 
 void handle_sigterm(int sig) {
   dtm->stop();
 }
+#else
+// set by the dromajo DPI once dromajo finished or the cosimulation failed
+extern "C" bool dromajo_done(int* status);
 #endif
 
+// Waveform dumping can be held back until RVFI commits this PC
+static bool dump_pc_armed = false;
+static uint64_t dump_pc = 0;
+static bool dump_triggered = true;
+
+extern "C" void rvfi_commit(long long pc) {
+  sim_perf().instret++;
+  if (dump_pc_armed && (uint64_t)pc == dump_pc) {
+    dump_triggered = true;
+    dump_pc_armed = false;
+  }
+}
+
 // Called by $time in Verilog converts to double, to match what SystemC does
 double sc_time_stamp () {
     return main_time;
 }
 
+#if VM_SAVABLE
+// A checkpoint holds main_time, the remote bitbang pin state and the whole
+// verilated model, including the preloaded memory. fesvr's DTM is not
+// serializable; checkpoints are only taken while it has no DMI request
+// outstanding, so a fresh DTM can pick up polling after a restore.
+static void save_model(const char* path, Variane_testharness* top) {
+  VerilatedSave os;
+  os.open(path);
+  os << main_time;
+#ifndef DROMAJO
+  remote_bitbang_t::state_t jtag_state = jtag->get_state();
+  os.write(&jtag_state, sizeof(jtag_state));
+#endif
+  os << *top;
+  os.close();
+}
+
+static void restore_model(const char* path, Variane_testharness* top) {
+  VerilatedRestore os;
+  os.open(path);
+  os >> main_time;
+#ifndef DROMAJO
+  remote_bitbang_t::state_t jtag_state;
+  os.read(&jtag_state, sizeof(jtag_state));
+  jtag->set_state(jtag_state);
+#endif
+  os >> *top;
+  os.close();
+}
+#endif
+
+struct perf_sample_t {
+  uint64_t cycles;
+  double wall_s;
+  sim_perf_t perf;
+};
+
+static void print_perf_sample(FILE* f, const perf_sample_t& s) {
+  const sim_perf_t& p = s.perf;
+  fprintf(f, "{\"cycles\": %lu, \"instret\": %lu, \"wall_s\": %.6f, "
+             "\"cycles_per_s\": %.1f, \"instret_per_s\": %.1f, "
+             "\"eval_s\": %.6f, \"trace_s\": %.6f, \"dtm_s\": %.6f, \"jtag_s\": %.6f}",
+          (unsigned long)s.cycles, (unsigned long)p.instret, s.wall_s,
+          s.wall_s > 0 ? s.cycles / s.wall_s : 0.0, s.wall_s > 0 ? p.instret / s.wall_s : 0.0,
+          p.eval_s - p.dtm_s - p.jtag_s, p.trace_s, p.dtm_s, p.jtag_s);
+}
+
 static void usage(const char * program_name) {
   printf("Usage: %s [EMULATOR OPTION]... [VERILOG PLUSARG]... [HOST OPTION]... BINARY [TARGET OPTION]...\n",
          program_name);
@@ -73,7 +148,19 @@ EMULATOR OPTIONS\n\
   -r, --rbb-port=PORT      Use PORT for remote bit bang (with OpenOCD and GDB) \n\
                            If not specified, a random port will be chosen\n\
                            automatically.\n\
+      --preload-raw=FILE   Preload main memory with the raw image FILE\n\
+                           (e.g. made by objcopy -O binary) instead of the\n\
+                           ELF's loadable segments.\n\
 ", stdout);
+#if VM_SAVABLE
+  fputs("\
+      --save=FILE          Write a checkpoint to FILE and stop once the\n\
+                           cycle given by --save-cycle is reached\n\
+      --save-cycle=CYCLE   Cycle to take the checkpoint at\n\
+      --restore=FILE       Resume from the checkpoint in FILE instead of\n\
+                           resetting and preloading the model\n\
+", stdout);
+#endif
 #if VM_TRACE == 0
   fputs("\
 \n\
@@ -81,8 +168,16 @@ EMULATOR DEBUG OPTIONS (only supported in debug build -- try `make debug`)\n",
         stdout);
 #endif
   fputs("\
-  -v, --vcd=FILE,          Write vcd trace to FILE (or '-' for stdout)\n\
+  -v, --vcd=FILE,          Write vcd trace to FILE (or '-' for stdout), a\n\
+                           FILE ending in .gz is written gzip compressed\n\
+      --dump-start=CYCLE   Start the trace at CYCLE\n\
+      --dump-end=CYCLE     Stop the trace at CYCLE\n\
+      --dump-pc=ADDR       Start the trace once the core commits ADDR\n\
+      --dump-ring=CYCLES   Only keep (at least) the last CYCLES cycles of\n\
+                           the trace, written out at the end of the run\n\
   -p,                      Print performance statistic at end of test\n\
+      --perf-file=FILE     Write throughput and phase timings as JSON to FILE\n\
+      --perf-interval=CYCLES Also sample them every CYCLES cycles\n\
 ", stdout);
   // fputs("\n" PLUSARG_USAGE_OPTIONS, stdout);
   fputs("\n" HTIF_USAGE_OPTIONS, stdout);
@@ -110,19 +205,117 @@ EMULATOR DEBUG OPTIONS (only supported in debug build -- try `make debug`)\n",
 class preload_aware_dtm_t : public dtm_t {
   public:
     preload_aware_dtm_t(int argc, char **argv) : dtm_t(argc, argv) {}
-    bool is_address_preloaded(addr_t taddr, size_t len) override { return true; }
+    // fesvr skips loading whatever lies in the preloaded main memory, anything
+    // else in the ELF still goes through the DTM
+    void set_preloaded(addr_t base, size_t size) { preload_base = base; preload_size = size; }
+    bool is_address_preloaded(addr_t taddr, size_t len) override {
+      return taddr >= preload_base && len <= preload_size && taddr - preload_base <= preload_size - len;
+    }
     // We do not want to reset the hart here as the reset function in `dtm_t` seems to disregard
     // the privilege level and in general does not perform propper reset (despite the name).
     // As all our binaries in preloading will always start at the base of DRAM this should not
     // be such a big problem.
     void reset() {}
+  private:
+    addr_t preload_base = 0;
+    size_t preload_size = 0;
 };
 
+// Map a file read-only, returns NULL if it cannot be opened.
+static char* map_file(const char* path, size_t* size) {
+  int fd = open(path, O_RDONLY);
+  struct stat s;
+  if (fd < 0 || fstat(fd, &s) < 0) {
+    if (fd >= 0) close(fd);
+    return NULL;
+  }
+  *size = s.st_size;
+  char* buf = (char*)mmap(NULL, *size ? *size : 1, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  return buf == MAP_FAILED ? NULL : buf;
+}
+
+// Copy the loadable segments of an ELF that lie in main memory straight into
+// the memory array. Segments partially outside of it are an error.
+static bool preload_elf(const char* path, char* mem, size_t mem_size) {
+  size_t size;
+  char* buf = map_file(path, &size);
+  if (!buf || size < sizeof(Elf64_Ehdr) || !(IS_ELF32(*(Elf64_Ehdr*)buf) || IS_ELF64(*(Elf64_Ehdr*)buf))) {
+    std::cerr << "Unable to read ELF " << path << "\n";
+    if (buf) munmap(buf, size ? size : 1);
+    return false;
+  }
+
+  bool ok = true;
+  #define PRELOAD_ELF(ehdr_t, phdr_t) do { \
+    ehdr_t* eh = (ehdr_t*)buf; \
+    phdr_t* ph = (phdr_t*)(buf + eh->e_phoff); \
+    if (size < eh->e_phoff + eh->e_phnum * sizeof(*ph)) { \
+      ok = false; \
+      break; \
+    } \
+    for (unsigned i = 0; i < eh->e_phnum && ok; i++) { \
+      if (ph[i].p_type != PT_LOAD || !ph[i].p_memsz) \
+        continue; \
+      if (ph[i].p_filesz > ph[i].p_memsz || size < ph[i].p_offset + ph[i].p_filesz) { \
+        std::cerr << "Malformed segment at 0x" << std::hex << ph[i].p_paddr \
+                  << std::dec << " in " << path << "\n"; \
+        ok = false; \
+        break; \
+      } \
+      /* segments outside main memory are left to fesvr */ \
+      if (ph[i].p_paddr + ph[i].p_memsz <= main_mem_base || \
+          ph[i].p_paddr >= main_mem_base + mem_size) \
+        continue; \
+      uint64_t offset = ph[i].p_paddr - main_mem_base; \
+      if (ph[i].p_paddr < main_mem_base || ph[i].p_memsz > mem_size - offset) { \
+        std::cerr << "Segment at 0x" << std::hex << ph[i].p_paddr << " of 0x" \
+                  << ph[i].p_memsz << " bytes does not fit into main memory of 0x" \
+                  << mem_size << " bytes\n" << std::dec; \
+        ok = false; \
+        break; \
+      } \
+      memcpy(mem + offset, buf + ph[i].p_offset, ph[i].p_filesz); \
+      memset(mem + offset + ph[i].p_filesz, 0, ph[i].p_memsz - ph[i].p_filesz); \
+    } \
+  } while (0)
+
+  if (IS_ELF32(*(Elf64_Ehdr*)buf))
+    PRELOAD_ELF(Elf32_Ehdr, Elf32_Phdr);
+  else
+    PRELOAD_ELF(Elf64_Ehdr, Elf64_Phdr);
+  #undef PRELOAD_ELF
+
+  munmap(buf, size);
+  return ok;
+}
+
+// Copy a raw memory image to the start of the memory array.
+static bool preload_raw(const char* path, char* mem, size_t mem_size) {
+  size_t size;
+  char* buf = map_file(path, &size);
+  if (!buf) {
+    std::cerr << "Unable to read memory image " << path << "\n";
+    return false;
+  }
+  bool ok = size <= mem_size;
+  if (ok)
+    memcpy(mem, buf, size);
+  else
+    std::cerr << "Memory image " << path << " of " << size
+              << " bytes does not fit into main memory of " << mem_size << " bytes\n";
+  munmap(buf, size ? size : 1);
+  return ok;
+}
+
 int main(int argc, char **argv) {
   std::clock_t c_start = std::clock();
   auto t_start = std::chrono::high_resolution_clock::now();
-  bool verbose;
-  bool perf;
+  bool verbose = false;
+  bool perf = false;
+  const char* perf_file = NULL;
+  uint64_t perf_interval = 0;
+  std::vector<perf_sample_t> perf_samples;
   unsigned random_seed = (unsigned)time(NULL) ^ (unsigned)getpid();
   uint64_t max_cycles = -1;
   int ret = 0;
@@ -131,10 +324,19 @@ int main(int argc, char **argv) {
   uint16_t rbb_port = 0;
 #if VM_TRACE
   FILE * vcdfile = NULL;
+  bool vcd_compress = false;
   uint64_t start = 0;
+  uint64_t end = -1;
+  uint64_t ring_cycles = 0;
 #endif
   char ** htif_argv = NULL;
   int verilog_plusargs_legal = 1;
+  const char* preload_image = NULL;
+#if VM_SAVABLE
+  const char* save_file = NULL;
+  const char* restore_file = NULL;
+  uint64_t save_cycle = 0;
+#endif
 
   while (1) {
     static struct option long_options[] = {
@@ -144,9 +346,20 @@ int main(int argc, char **argv) {
       {"seed",        required_argument, 0, 's' },
       {"rbb-port",    required_argument, 0, 'r' },
       {"verbose",     no_argument,       0, 'V' },
+      {"preload-raw", required_argument, 0, 'I' },
+      {"perf-file",   required_argument, 0, 'J' },
+      {"perf-interval", required_argument, 0, 'K' },
+#if VM_SAVABLE
+      {"save",        required_argument, 0, 'S' },
+      {"save-cycle",  required_argument, 0, 'C' },
+      {"restore",     required_argument, 0, 'R' },
+#endif
 #if VM_TRACE
       {"vcd",         required_argument, 0, 'v' },
       {"dump-start",  required_argument, 0, 'x' },
+      {"dump-end",    required_argument, 0, 'y' },
+      {"dump-pc",     required_argument, 0, 't' },
+      {"dump-ring",   required_argument, 0, 'b' },
 #endif
       HTIF_LONG_OPTIONS
     };
@@ -168,12 +381,21 @@ int main(int argc, char **argv) {
       case 'r': rbb_port = atoi(optarg);    break;
       case 'V': verbose = true;             break;
       case 'p': perf = true;                break;
+      case 'I': preload_image = optarg;     break;
+      case 'J': perf_file = optarg;         break;
+      case 'K': perf_interval = atoll(optarg); break;
+#if VM_SAVABLE
+      case 'S': save_file = optarg;         break;
+      case 'C': save_cycle = atoll(optarg); break;
+      case 'R': restore_file = optarg;      break;
+#endif
 #ifdef DROMAJO
 			case 'D': break;
 #endif
 #if VM_TRACE
       case 'v': {
         vcdfile = strcmp(optarg, "-") == 0 ? stdout : fopen(optarg, "w");
+        vcd_compress = strlen(optarg) > 3 && strcmp(optarg + strlen(optarg) - 3, ".gz") == 0;
         if (!vcdfile) {
           std::cerr << "Unable to open " << optarg << " for VCD write\n";
           return 1;
@@ -181,6 +403,14 @@ int main(int argc, char **argv) {
         break;
       }
       case 'x': start = atoll(optarg);      break;
+      case 'y': end = atoll(optarg);        break;
+      case 't': {
+        dump_pc = strtoull(optarg, NULL, 0);
+        dump_pc_armed = true;
+        dump_triggered = false;
+        break;
+      }
+      case 'b': ring_cycles = atoll(optarg); break;
 #endif
       // Process legacy '+' EMULATOR arguments by replacing them with
       // their getopt equivalents
@@ -207,6 +437,18 @@ int main(int argc, char **argv) {
           c = 'x';
           optarg = optarg+12;
         }
+        else if (arg.substr(0, 10) == "+dump-end=") {
+          c = 'y';
+          optarg = optarg+10;
+        }
+        else if (arg.substr(0, 9) == "+dump-pc=") {
+          c = 't';
+          optarg = optarg+9;
+        }
+        else if (arg.substr(0, 11) == "+dump-ring=") {
+          c = 'b';
+          optarg = optarg+11;
+        }
 #endif
         else if (arg.substr(0, 12) == "+cycle-count")
           c = 'c';
@@ -279,79 +521,151 @@ done_processing:
 
 #ifndef DROMAJO
   jtag = new remote_bitbang_t(rbb_port);
-  dtm = new preload_aware_dtm_t(htif_argc, htif_argv);
+  preload_aware_dtm_t* preload_dtm = new preload_aware_dtm_t(htif_argc, htif_argv);
+  dtm = preload_dtm;
   signal(SIGTERM, handle_sigterm);
 #endif
 
   std::unique_ptr<Variane_testharness> top(new Variane_testharness);
 
-  // Use an hitf hexwriter to read the binary data.
-  htif_hexwriter_t htif(0x0, 1, -1);
-  memif_t memif(&htif);
-  reg_t entry;
-  load_elf(htif_argv[1], &memif, &entry);
-
 #if VM_TRACE
   Verilated::traceEverOn(true); // Verilator must compute traced signals
-  std::unique_ptr<VerilatedVcdFILE> vcdfd(new VerilatedVcdFILE(vcdfile));
-  std::unique_ptr<VerilatedVcdC> tfp(new VerilatedVcdC(vcdfd.get()));
+  // the trace is compressed and written out on a separate thread
+  std::unique_ptr<VerilatedVcdAsync> vcdfd(new VerilatedVcdAsync(vcdfile, vcd_compress));
+  std::unique_ptr<VerilatedVcdRING> ring(ring_cycles ? new VerilatedVcdRING(vcdfd.get()) : NULL);
+  std::unique_ptr<VerilatedVcdC> tfp(new VerilatedVcdC(ring ? (VerilatedVcdFile*)ring.get() : vcdfd.get()));
+  uint64_t ring_start = 0;
+  // only pay for tracing inside the requested window
+  #define DUMP_ENABLED() (vcdfile && dump_triggered && main_time >= start && main_time < end)
   if (vcdfile) {
     top->trace(tfp.get(), 99);  // Trace 99 levels of hierarchy
     tfp->open("");
   }
 #endif
 
-  for (int i = 0; i < 10; i++) {
-    top->rst_ni = 0;
-    top->clk_i = 0;
-    top->rtc_i = 0;
-    top->eval();
+  bool restored = false;
+#if VM_SAVABLE
+  // a checkpoint already contains the reset and preloaded model
+  if (restore_file) {
+    restore_model(restore_file, top.get());
+    fprintf(stderr, "Restored checkpoint %s at cycle %ld\n", restore_file, main_time);
+    restored = true;
+  }
+#endif
+
+  if (!restored) {
+    for (int i = 0; i < 10; i++) {
+      top->rst_ni = 0;
+      top->clk_i = 0;
+      top->rtc_i = 0;
+      top->eval();
 #if VM_TRACE
-      tfp->dump(static_cast<vluint64_t>(main_time * 2));
+      if (DUMP_ENABLED())
+        tfp->dump(static_cast<vluint64_t>(main_time * 2));
 #endif
-    top->clk_i = 1;
-    top->eval();
+      top->clk_i = 1;
+      top->eval();
 #if VM_TRACE
-      tfp->dump(static_cast<vluint64_t>(main_time * 2 + 1));
+      if (DUMP_ENABLED())
+        tfp->dump(static_cast<vluint64_t>(main_time * 2 + 1));
 #endif
-    main_time++;
+      main_time++;
+    }
+    top->rst_ni = 1;
+
+    // Preload memory, only the ranges the image actually covers are written.
+    char* main_mem = (char*)&MAIN_MEM;
+    size_t main_mem_size = sizeof(MAIN_MEM);
+    if (preload_image) {
+      if (!preload_raw(preload_image, main_mem, main_mem_size))
+        return 1;
+    } else if (htif_argc > 1 && !preload_elf(htif_argv[1], main_mem, main_mem_size)) {
+      return 1;
+    }
   }
-  top->rst_ni = 1;
+#ifndef DROMAJO
+  preload_dtm->set_preloaded(main_mem_base, sizeof(MAIN_MEM));
+#endif
 
-  // Preload memory.
-  size_t mem_size = 0xFFFFFF;
-  memif.read(0x80000000, mem_size, (void *)top->ariane_testharness__DOT__i_sram__DOT__gen_cut__BRA__0__KET____DOT__gen_mem__DOT__i_ram__DOT__Mem_DP);
+  sim_perf().enabled = perf || perf_file;
+  auto perf_sample = [&] {
+    perf_sample_t s = {(uint64_t)main_time, 0, sim_perf()};
+    s.wall_s = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t_start).count();
+    return s;
+  };
 
 #ifndef DROMAJO
   while (!dtm->done() && !jtag->done()) {
 #else
-  // the simulation gets killed by dromajo
-  while (true) {
+  int dromajo_status = 0;
+  while (!dromajo_done(&dromajo_status)) {
 #endif
     top->clk_i = 0;
-    top->eval();
+    {
+      sim_perf_timer_t timer(sim_perf().eval_s);
+      top->eval();
+    }
 #if VM_TRACE
-    // dump = tfp && trace_count >= start;
-    // if (dump)
+    bool dump = DUMP_ENABLED();
+    if (dump) {
+      sim_perf_timer_t timer(sim_perf().trace_s);
+      if (ring && main_time - ring_start >= ring_cycles) {
+        // start a new segment, the ring keeps this and the previous one
+        tfp->openNext(false);
+        ring_start = main_time;
+      }
       tfp->dump(static_cast<vluint64_t>(main_time * 2));
+    }
 #endif
 
     top->clk_i = 1;
-    top->eval();
+    {
+      sim_perf_timer_t timer(sim_perf().eval_s);
+      top->eval();
+    }
 #if VM_TRACE
-    // if (dump)
+    if (dump) {
+      sim_perf_timer_t timer(sim_perf().trace_s);
       tfp->dump(static_cast<vluint64_t>(main_time * 2 + 1));
+    }
 #endif
     // toggle RTC
     if (main_time % 2 == 0) {
       top->rtc_i ^= 1;
     }
     main_time++;
+
+    if (perf_interval && main_time % perf_interval == 0) {
+      perf_samples.push_back(perf_sample());
+      if (perf) {
+        print_perf_sample(stderr, perf_samples.back());
+        fputc('\n', stderr);
+      }
+    }
+
+#if VM_SAVABLE
+#ifndef DROMAJO
+    // only between debug transactions, neither side of them is saved
+    if (save_file && main_time >= save_cycle && dtm_idle() && jtag->idle()) {
+#else
+    if (save_file && main_time >= save_cycle) {
+#endif
+      save_model(save_file, top.get());
+      fprintf(stderr, "Saved checkpoint %s at cycle %ld\n", save_file, main_time);
+      break;
+    }
+#endif
   }
 
+  // run the final blocks, they flush what the tracers still buffer
+  top->final();
+
 #if VM_TRACE
   if (tfp)
     tfp->close();
+  if (ring)
+    ring->flush();
+  vcdfd->finish();
   if (vcdfile)
     fclose(vcdfile);
 #endif
@@ -369,17 +683,44 @@ done_processing:
 
   if (dtm) delete dtm;
   if (jtag) delete jtag;
+#else
+  if (dromajo_status) {
+    fprintf(stderr, "*** FAILED *** (code = %d) after %ld cycles\n", dromajo_status, main_time);
+    ret = dromajo_status;
+  } else {
+    fprintf(stderr, "completed after %ld cycles\n", main_time);
+  }
 #endif
 
   std::clock_t c_end = std::clock();
   auto t_end = std::chrono::high_resolution_clock::now();
 
+  perf_sample_t total = perf_sample();
   if (perf) {
     std::cout << std::fixed << std::setprecision(2) << "CPU time used: "
               << 1000.0 * (c_end-c_start) / CLOCKS_PER_SEC << " ms\n"
               << "Wall clock time passed: "
               << std::chrono::duration<double, std::milli>(t_end-t_start).count()
               << " ms\n";
+    print_perf_sample(stdout, total);
+    fputc('\n', stdout);
+  }
+
+  if (perf_file) {
+    FILE* f = fopen(perf_file, "w");
+    if (f) {
+      fprintf(f, "{\"cpu_s\": %.6f,\n \"total\": ", double(c_end - c_start) / CLOCKS_PER_SEC);
+      print_perf_sample(f, total);
+      fprintf(f, ",\n \"samples\": [");
+      for (size_t i = 0; i < perf_samples.size(); i++) {
+        fprintf(f, i ? ",\n  " : "\n  ");
+        print_perf_sample(f, perf_samples[i]);
+      }
+      fprintf(f, "]}\n");
+      fclose(f);
+    } else {
+      std::cerr << "Unable to open " << perf_file << " for performance statistics\n";
+    }
   }
 
   return ret;
@@ -24,6 +24,7 @@ import uvm_pkg::*;
 import "DPI-C" function read_elf(input string filename);
 import "DPI-C" function byte get_section(output longint address, output longint len);
 import "DPI-C" context function void read_section(input longint address, inout byte buffer[]);
+import "DPI-C" context function void read_section_words(input longint address, inout longint unsigned buffer[]);
 
 module ariane_tb;
 
@@ -120,9 +121,8 @@ module ariane_tb;
     // for faster simulation we can directly preload the ELF
     // Note that we are loosing the capabilities to use risc-fesvr though
     initial begin
-        automatic logic [7:0][7:0] mem_row;
         longint address, len;
-        byte buffer[];
+        longint unsigned buffer[];
         void'(uvcl.get_arg_value("+PRELOAD=", binary));
 
         if (binary != "") begin
@@ -134,19 +134,14 @@ module ariane_tb;
 
             // while there are more sections to process
             while (get_section(address, len)) begin
-                automatic int num_words = (len+7)/8;
+                automatic int num_words = (address[2:0]+len+7)/8;
                 `uvm_info( "Core Test", $sformatf("Loading Address: %x, Length: %x", address, len),
 UVM_LOW)
-                buffer = new [num_words*8];
-                void'(read_section(address, buffer));
-                // preload memories
-                // 64-bit
+                buffer = new [num_words];
+                // the section arrives as ready-made 64-bit memory rows
+                void'(read_section_words(address, buffer));
                 for (int i = 0; i < num_words; i++) begin
-                    mem_row = '0;
-                    for (int j = 0; j < 8; j++) begin
-                        mem_row[j] = buffer[i*8 + j];
-                    end
-                    `MAIN_MEM((address[28:0] >> 3) + i) = mem_row;
+                    `MAIN_MEM((address[28:0] >> 3) + i) = buffer[i];
                 end
             end
         end
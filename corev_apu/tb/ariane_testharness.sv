@@ -136,6 +136,19 @@ module ariane_testharness #(
     .exit                 ( jtag_exit            )
   );
 
+  // let the remote bitbang server sleep on its socket while the core is
+  // parked in debug mode instead of spinning the model
+  logic jtag_halted_q;
+  always_ff @(posedge clk_i or negedge rst_ni) begin
+    if (~rst_ni) begin
+      jtag_halted_q <= 1'b0;
+    end else begin
+      jtag_halted_q <= i_ariane.i_cva6.debug_mode;
+      if (jtag_enable[0] && i_ariane.i_cva6.debug_mode != jtag_halted_q)
+        jtag_set_halted(i_ariane.i_cva6.debug_mode);
+    end
+  end
+
   dmi_jtag i_dmi_jtag (
     .clk_i            ( clk_i           ),
     .rst_ni           ( rst_ni          ),
@@ -12,7 +12,9 @@ import "DPI-C" function int debug_tick
   input  bit        debug_resp_valid,
   output bit        debug_resp_ready,
   input  int        debug_resp_bits_resp,
-  input  int        debug_resp_bits_data
+  input  int        debug_resp_bits_data,
+
+  output bit        debug_idle
 );
 
 module SimDTM(
@@ -35,6 +37,20 @@ module SimDTM(
 
   bit r_reset;
 
+  // While fesvr has no DMI transaction in flight it only counts ticks until it
+  // polls tohost again. +dtm_idle_skip=<n> skips n cycles after each such
+  // tick, which saves the DPI call and the switch into fesvr's thread on
+  // them. fesvr counts ticks, not cycles, so this also stretches the time
+  // between its polls by n+1 and delays syscalls and exit detection; it is
+  // off (0) by default.
+  int unsigned idle_skip = 0;
+  int unsigned idle_count;
+  bit __debug_idle;
+
+  initial begin
+    void'($value$plusargs("dtm_idle_skip=%d", idle_skip));
+  end
+
   wire #0.1 __debug_req_ready = debug_req_ready;
   wire #0.1 __debug_resp_valid = debug_resp_valid;
   wire [31:0] #0.1 __debug_resp_bits_resp = {30'b0, debug_resp_bits_resp};
@@ -62,6 +78,11 @@ module SimDTM(
       __debug_req_valid = 0;
       __debug_resp_ready = 0;
       __exit = 0;
+      idle_count = 0;
+    end
+    else if (idle_count != 0)
+    begin
+      idle_count--;
     end
     else
     begin
@@ -74,8 +95,10 @@ module SimDTM(
         __debug_resp_valid,
         __debug_resp_ready,
         __debug_resp_bits_resp,
-        __debug_resp_bits_data
+        __debug_resp_bits_data,
+        __debug_idle
       );
+      if (__debug_idle) idle_count = idle_skip;
     end
   end
 endmodule
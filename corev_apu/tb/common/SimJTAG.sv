@@ -10,6 +10,11 @@ import "DPI-C" function int jtag_tick
  input bit  jtag_TDO
 );
 
+import "DPI-C" function void jtag_set_halted
+(
+ input bit halted
+);
+
 module SimJTAG #(
                  parameter TICK_DELAY = 50
                  )(
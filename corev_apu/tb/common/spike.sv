@@ -16,7 +16,7 @@ import uvm_pkg::*;
 
 `include "uvm_macros.svh"
 
-import "DPI-C" function int spike_create(string filename, longint unsigned dram_base, int unsigned size);
+import "DPI-C" function int spike_create(string filename, longint unsigned dram_base, longint unsigned size);
 
 typedef riscv::commit_log_t riscv_commit_log_t;
 import "DPI-C" function void spike_tick(output riscv_commit_log_t commit_log);
@@ -25,7 +25,11 @@ import "DPI-C" function void clint_tick();
 
 module spike #(
     parameter longint unsigned DramBase = 'h8000_0000,
-    parameter int unsigned     Size     = 64 * 1024 * 1024 // 64 Mega Byte
+    parameter longint unsigned Size     = 64 * 1024 * 1024, // 64 Mega Byte
+    // number of instructions Spike retires per DPI call, 1 steps in lockstep.
+    // Larger batches let Spike run ahead of clint_tick, so only use them for
+    // programs that take no timer or software interrupts.
+    parameter int unsigned     TickBatch = 1
 )(
     input logic       clk_i,
     input logic       rst_ni,
@@ -51,7 +55,16 @@ module spike #(
         void'(spike_create(binary, DramBase, Size));
     end
 
+    // Spike runs ahead by up to TickBatch instructions. The records are kept
+    // in tick_buf and consumed in commit order, a batch ends after a trap.
+    // An asynchronous interrupt is only seen once its clint_tick arrives,
+    // which may be after Spike already executed past the point where the
+    // RTL took it.
+    import "DPI-C" function int spike_tick_n(output riscv_commit_log_t commit_log [TickBatch], input int unsigned n);
+
     riscv_commit_log_t commit_log;
+    riscv_commit_log_t tick_buf [TickBatch];
+    int unsigned tick_head = 0, tick_count = 0;
     logic [31:0] instr;
 
     always_ff @(posedge clk_i) begin
@@ -59,7 +72,16 @@ module spike #(
 
             for (int i = 0; i < ariane_pkg::NR_COMMIT_PORTS; i++) begin
                 if ((commit_instr_i[i].valid && commit_ack_i[i]) || (commit_instr_i[i].valid && exception_i.valid)) begin
-                    spike_tick(commit_log);
+                    if (TickBatch == 1) begin
+                        spike_tick(commit_log);
+                    end else begin
+                        if (tick_head == tick_count) begin
+                            tick_count = spike_tick_n(tick_buf, TickBatch);
+                            tick_head = 0;
+                        end
+                        commit_log = tick_buf[tick_head];
+                        tick_head++;
+                    end
                     instr = (commit_log.instr[1:0] != 2'b11) ? {16'b0, commit_log.instr[15:0]} : commit_log.instr;
                     // $display("\x1B[32m%h %h\x1B[0m", commit_log.pc, instr);
                     // $display("%p", commit_log);
@@ -1,5 +1,6 @@
 // See LICENSE.SiFive for license details.
 #include "msim_helper.h"
+#include "sim_perf.h"
 
 #include <fesvr/dtm.h>
 #include <vpi_user.h>
@@ -9,6 +10,15 @@
 #include <vector>
 
 dtm_t* dtm;
+// a request was accepted by the debug module and its response is pending
+static bool dtm_in_flight;
+
+// No DMI request is waiting to be sent or for its response, so the model
+// and fesvr agree on every transaction, e.g. to take a checkpoint.
+bool dtm_idle()
+{
+  return !dtm || (!dtm->req_valid() && !dtm_in_flight);
+}
 
 extern "C" int debug_tick
 (
@@ -20,7 +30,8 @@ extern "C" int debug_tick
   unsigned char  debug_resp_valid,
   unsigned char* debug_resp_ready,
   int            debug_resp_bits_resp,
-  int            debug_resp_bits_data
+  int            debug_resp_bits_data,
+  unsigned char* debug_idle
 )
 {
 
@@ -39,6 +50,12 @@ extern "C" int debug_tick
       dtm = new dtm_t(argc, argv);
   }
 
+  sim_perf_timer_t timer(sim_perf().dtm_s);
+  if (dtm->req_valid() && debug_req_ready)
+    dtm_in_flight = true;
+  if (debug_resp_valid)
+    dtm_in_flight = false;
+
   dtm_t::resp resp_bits;
   resp_bits.resp = debug_resp_bits_resp;
   resp_bits.data = debug_resp_bits_data;
@@ -55,6 +72,8 @@ extern "C" int debug_tick
   *debug_req_bits_addr = dtm->req_bits().addr;
   *debug_req_bits_op = dtm->req_bits().op;
   *debug_req_bits_data = dtm->req_bits().data;
+  // nothing to send and nothing to wait for: fesvr is between polls
+  *debug_idle = !dtm->req_valid() && !dtm_in_flight;
 
   return dtm->done() ? (dtm->exit_code() << 1 | 1) : 0;
 }
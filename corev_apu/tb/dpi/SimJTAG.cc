@@ -2,8 +2,17 @@
 
 #include <cstdlib>
 #include "remote_bitbang.h"
+#include "sim_perf.h"
 
 remote_bitbang_t* jtag;
+static bool jtag_halted;
+
+// Called by the testharness when the core enters or leaves debug mode.
+extern "C" void jtag_set_halted(unsigned char halted)
+{
+  jtag_halted = halted;
+}
+
 extern "C" int jtag_tick
 (
  unsigned char * jtag_TCK,
@@ -18,6 +27,8 @@ extern "C" int jtag_tick
     jtag = new remote_bitbang_t(0);
   }
 
+  jtag->set_halted(jtag_halted);
+  sim_perf_timer_t timer(sim_perf().jtag_s);
   jtag->tick(jtag_TCK, jtag_TMS, jtag_TDI, jtag_TRSTn, jtag_TDO);
 
   return jtag->done() ? (jtag->exit_code() << 1 | 1) : 0;
@@ -13,9 +13,11 @@
 // Description: DPI wrappers to interface with Dromajo RISC-V emulator
 
 #include <svdpi.h>
+#include <cstdio>
 #include <iostream>
 #include "dromajo_cosim.h"
 #include "stdlib.h"
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -26,26 +28,122 @@
 dromajo_cosim_state_t* dromajo_pointer;
 
 /**
- * set the counter variable to number of instructions
- * you want to commit after the cosim failure. This is 
- * sometimes useful when debugging to see waveform 
- * activity post failure
+ * per-hart cosim failure state. After a mismatch a hart keeps
+ * committing for run_on more instructions before the simulation
+ * is stopped, which is sometimes useful when debugging to see
+ * waveform activity post failure
  */
-bool kill_soon = false;
-uint32_t counter = 0;
+struct dromajo_hart_t {
+  bool     kill_soon;
+  uint32_t counter;
+};
+static std::vector<dromajo_hart_t> harts;
+static uint32_t run_on = 0;
+
+/**
+ * harts that called init_dromajo, and how the cosimulation ended.
+ * The DPI calls run inside the verilated model's eval(), so instead
+ * of exiting from there the testbench polls dromajo_done() and shuts
+ * the model down (running its final blocks) itself.
+ */
+static unsigned int num_harts = 0;
+static bool done = false;
+static int exit_status = 0;
+
+static void finish(int status) {
+  done = true;
+  exit_status = status;
+}
+
+/**
+ * @return whether dromajo finished or the cosimulation failed,
+ *         the exit status is stored in *status
+ */
+extern "C" bool dromajo_done(int* status) {
+  if (done && status)
+    *status = exit_status;
+  return done;
+}
+
+/**
+ * @return number of harts that initialized the cosimulation
+ */
+extern "C" unsigned int dromajo_num_harts() {
+  return num_harts;
+}
 
 /**
  * Initialize dromajo emulator
  *
  * This function should usually be called from the initial
- * block in RTL.
+ * block in RTL. Every hart calls it, only the first call
+ * creates the emulator, which models all harts.
  *
- * @param config (.cfg) file with the configurations
+ * @param cfg_f_name - (.cfg) file with the configurations
+ * @param args       - extra whitespace separated dromajo options
+ * @param run_on_n   - instructions a hart may commit after a mismatch
  */
-extern "C" void init_dromajo(char* cfg_f_name) {
-  char *argv[] = {(char*)"Variane", cfg_f_name};
+extern "C" void init_dromajo(const char* cfg_f_name,
+                             const char* args,
+                             unsigned int run_on_n) {
+  num_harts++;
+  if (dromajo_pointer)
+    return;
 
-  dromajo_pointer = dromajo_cosim_init(2, argv);
+  // dromajo expects its options ahead of the config file
+  std::vector<std::string> words;
+  std::istringstream in(args ? args : "");
+  for (std::string w; in >> w; )
+    words.push_back(w);
+  std::vector<char*> argv;
+  argv.push_back((char*)"Variane");
+  for (auto& w : words)
+    argv.push_back(&w[0]);
+  argv.push_back((char*)cfg_f_name);
+  argv.push_back(NULL);
+
+  run_on = run_on_n;
+  dromajo_pointer = dromajo_cosim_init(argv.size() - 1, argv.data());
+}
+
+/**
+ * Failure state of a hart, created on its first commit
+ */
+static dromajo_hart_t& hart(int hart_id) {
+  if ((size_t)hart_id >= harts.size())
+    harts.resize(hart_id + 1, dromajo_hart_t{false, run_on});
+  return harts[hart_id];
+}
+
+/**
+ * Step dromajo over one committed instruction
+ *
+ * @return the dromajo exit code, 0x2 when dromajo is done and
+ *         above 0x3 on a mismatch
+ */
+static int step(int hart_id, uint64_t pc, uint32_t insn, uint64_t wdata) {
+  int exit_code;
+  do {
+    exit_code = dromajo_cosim_step(dromajo_pointer, hart_id, pc, insn, wdata, 0, true);
+  } while (exit_code == 0x3);
+  return exit_code;
+}
+
+/**
+ * Count down the instructions a hart has left after a cosim failure
+ */
+static void check_kill(int hart_id) {
+  dromajo_hart_t& h = hart(hart_id);
+  if (h.kill_soon) {
+    if (h.counter == 0) {
+      std::cout << "Cosim failed on hart " << hart_id << "!" << std::endl;
+      finish(1);
+      return;
+    } else {
+      std::cout << "Let's let it run for a couple of instructions\n";
+    }
+    h.counter--;
+  }
 }
 
 /**
@@ -67,25 +165,76 @@ extern "C" void dromajo_step(int      hart_id,
                              uint32_t insn,
                              uint64_t wdata,
                              uint64_t cycle) {
-  int exit_code;
-  do {
-    exit_code = dromajo_cosim_step(dromajo_pointer, hart_id, pc, insn, wdata, 0, true);
-  } while (exit_code == 0x3);
+  if (done)
+    return;
+
+  int exit_code = step(hart_id, pc, insn, wdata);
 
   if (exit_code > 3) {
-    kill_soon = true;
+    hart(hart_id).kill_soon = true;
   } else if (exit_code == 0x2){
-    exit(0);
+    finish(0);
+    return;
   }
 
-  if (kill_soon) {
-    if (counter == 0) {
-      std::cout << "Cosim failed!" << std::endl;
-      exit(1);
-    } else {
-      std::cout << "Let's let it run for a couple of instructions" << std::endl;
+  check_kill(hart_id);
+}
+
+/**
+ * Progress the emulator over a batch of commits
+ *
+ * Validates the instructions and traps the RTL collected over
+ * several cycles in one call. The records are replayed in commit
+ * order, so a trap is raised exactly between the instructions it
+ * was taken between in RTL. The first mismatch is reported together
+ * with the records leading up to it. Record i is spread over the
+ * i-th element of each array.
+ *
+ * @param hart_id - id of the HART that committed the records
+ * @param is_trap - nonzero for a trap, whose cause is in wdata
+ * @param pc      - pc of the instruction
+ * @param insn    - RISCV instruction being committed
+ * @param wdata   - the value being committed, or the trap cause
+ * @param cycle   - clock cycle number (not compared)
+ * @param n       - number of valid records
+ */
+extern "C" void dromajo_step_n(int             hart_id,
+                               const int*      is_trap,
+                               const uint64_t* pc,
+                               const uint32_t* insn,
+                               const uint64_t* wdata,
+                               const uint64_t* cycle,
+                               unsigned int    n) {
+  const unsigned context = 8;
+
+  for (unsigned i = 0; i < n && !done; i++) {
+    if (is_trap[i]) {
+      std::cout << "Dromajo trapping. Cause = " << wdata[i] << '\n';
+      dromajo_cosim_raise_trap(dromajo_pointer, hart_id, wdata[i]);
+      continue;
     }
-    counter--;
+
+    int exit_code = step(hart_id, pc[i], insn[i], wdata[i]);
+    if (exit_code > 3 && !hart(hart_id).kill_soon) {
+      hart(hart_id).kill_soon = true;
+      fprintf(stderr, "Cosim mismatch on hart %d at record %u of %u, last records:\n",
+              hart_id, i, n);
+      for (unsigned j = i >= context ? i - context : 0; j <= i; j++) {
+        if (is_trap[j]) {
+          fprintf(stderr, "  %c cycle %lu trap cause 0x%lx\n", j == i ? '>' : ' ',
+                  (unsigned long)cycle[j], (unsigned long)wdata[j]);
+        } else {
+          fprintf(stderr, "  %c cycle %lu pc 0x%016lx insn 0x%08x wdata 0x%016lx\n",
+                  j == i ? '>' : ' ', (unsigned long)cycle[j],
+                  (unsigned long)pc[j], insn[j], (unsigned long)wdata[j]);
+        }
+      }
+    } else if (exit_code == 0x2) {
+      finish(0);
+      break;
+    }
+
+    check_kill(hart_id);
   }
 }
 
@@ -97,6 +246,8 @@ extern "C" void dromajo_step(int      hart_id,
  */
 extern "C" void dromajo_trap(int      hart_id,
                              uint64_t cause) {
+  if (done)
+    return;
   std::cout << "Dromajo trapping. Cause = " << cause << std::endl;
   dromajo_cosim_raise_trap(dromajo_pointer, hart_id, cause);
 }
@@ -3,6 +3,7 @@
 
 #include <svdpi.h>
 
+#include <algorithm>
 #include <cstring>
 #include <string>
 #include <sys/stat.h>
@@ -22,18 +23,25 @@
 // address and size
 std::vector<std::pair<reg_t, reg_t>> sections;
 std::map<std::string, uint64_t> symbols;
-// memory based address and content
-std::map<reg_t, std::vector<uint8_t>> mems;
+// file contents of each loaded segment, pointing into the mapped ELF which
+// stays mapped for the lifetime of the simulation
+struct segment_t {
+  reg_t address;
+  reg_t filesz;
+  reg_t memsz;
+  const char* data;
+};
+std::vector<segment_t> segments;
 reg_t entry;
 int section_index = 0;
 
-void write (uint64_t address, uint64_t len, uint8_t* buf) {
-    uint64_t datum;
-    std::vector<uint8_t> mem;
-    for (int i = 0; i < len; i++) {
-        mem.push_back(buf[i]);
-    }
-    mems.insert(std::make_pair(address, mem));
+static const segment_t& find_segment (reg_t address) {
+    for (auto &seg : segments)
+      if (seg.address == address)
+        return seg;
+    // the address has to point to a section
+    assert(0 && "no section at address");
+    abort();
 }
 
 // Communicate the section address and len
@@ -52,13 +60,33 @@ extern "C" char get_section (long long* address, long long* len) {
 extern "C" void read_section (long long address, const svOpenArrayHandle buffer) {
     // get actual poitner
     void* buf = svGetArrayPtr(buffer);
-    // check that the address points to a section
-    assert(mems.count(address) > 0);
-    // copy array
-    int i = 0;
-    for (auto &datum : mems.find(address)->second) {
-      *((char *) buf + i) = datum;
-      i++;
+    const segment_t& seg = find_segment(address);
+    memcpy(buf, seg.data, seg.filesz);
+}
+
+// Fill buffer with the section as little-endian 64-bit memory rows. Row 0
+// is the row containing address, the section starts at byte address % 8 of
+// it. The rows are written whole, so the bytes of a first or last row that
+// lie outside the section carry whatever other segments load there; all
+// remaining bytes not covered by file contents are zero.
+extern "C" void read_section_words (long long address, const svOpenArrayHandle buffer) {
+    uint64_t* buf = (uint64_t*)svGetArrayPtr(buffer);
+    size_t words = svSize(buffer, 1);
+    const segment_t& seg = find_segment(address);
+    size_t offset = address & 7;
+    assert(offset + seg.filesz <= words * 8);
+    memset(buf, 0, words * 8);
+    memcpy((char*)buf + offset, seg.data, seg.filesz);
+
+    reg_t row_start = address & ~reg_t(7), row_end = row_start + words * 8;
+    for (auto &other : segments) {
+      if (&other == &seg)
+        continue;
+      reg_t lo = std::max(other.address, row_start);
+      reg_t hi = std::min(other.address + other.filesz, row_end);
+      for (reg_t a = lo; a < hi; a++)
+        if (a < seg.address || a >= seg.address + seg.memsz)
+          ((char*)buf)[a - row_start] = other.data[a - other.address];
     }
 }
 
@@ -70,6 +98,7 @@ extern "C" void read_elf(const char* filename) {
     abort();
     size_t size = s.st_size;
 
+    // the sections are handed out straight from this mapping, so keep it
     char* buf = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
     assert(buf != MAP_FAILED);
     close(fd);
@@ -93,7 +122,7 @@ extern "C" void read_elf(const char* filename) {
         if (ph[i].p_filesz) { \
           assert(size >= ph[i].p_offset + ph[i].p_filesz); \
           sections.push_back(std::make_pair(ph[i].p_paddr, ph[i].p_memsz)); \
-          write(ph[i].p_paddr, ph[i].p_filesz, (uint8_t*)buf + ph[i].p_offset); \
+          segments.push_back({ph[i].p_paddr, ph[i].p_filesz, ph[i].p_memsz, buf + ph[i].p_offset}); \
         } \
         zeros.resize(ph[i].p_memsz - ph[i].p_filesz); \
       } \
@@ -130,6 +159,4 @@ extern "C" void read_elf(const char* filename) {
     LOAD_ELF(Elf32_Ehdr, Elf32_Phdr, Elf32_Shdr, Elf32_Sym);
   else
     LOAD_ELF(Elf64_Ehdr, Elf64_Phdr, Elf64_Shdr, Elf64_Sym);
-
-  munmap(buf, size);
 }
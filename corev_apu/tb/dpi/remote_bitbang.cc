@@ -3,6 +3,7 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -21,6 +22,7 @@ remote_bitbang_t::remote_bitbang_t(uint16_t port) :
   client_fd(0),
   recv_start(0),
   recv_end(0),
+  send_end(0),
   err(0)
 {
   socket_fd = socket(AF_INET, SOCK_STREAM, 0);
@@ -69,33 +71,58 @@ remote_bitbang_t::remote_bitbang_t(uint16_t port) :
   tdi = 1;
   trstn = 1;
   quit = 0;
+  halted = false;
 
   fprintf(stderr, "This emulator compiled with JTAG Remote Bitbang client. To enable, use +jtag_rbb_enable=1.\n");
   fprintf(stderr, "Listening on port %d\n",
          ntohs(addr.sin_port));
 }
 
+void remote_bitbang_t::set_state(const state_t& s)
+{
+  tck = s.tck;
+  tms = s.tms;
+  tdi = s.tdi;
+  trstn = s.trstn;
+  tdo = s.tdo;
+  quit = s.quit;
+  err = s.err;
+}
+
+void remote_bitbang_t::wait_for(int fd, short events)
+{
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = events;
+  while (poll(&pfd, 1, -1) == -1) {
+    if (errno != EINTR) {
+      fprintf(stderr, "remote_bitbang failed to poll socket: %s (%d)\n",
+              strerror(errno), errno);
+      abort();
+    }
+  }
+}
+
 void remote_bitbang_t::accept()
 {
 
   fprintf(stderr,"Attempting to accept client socket\n");
-  int again = 1;
-  while (again != 0) {
+  while (1) {
     client_fd = ::accept(socket_fd, NULL, NULL);
-    if (client_fd == -1) {
-      if (errno == EAGAIN) {
-        // No client waiting to connect right now.
-      } else {
-        fprintf(stderr, "failed to accept on socket: %s (%d)\n", strerror(errno),
-                errno);
-        again = 0;
-        abort();
-      }
-    } else {
+    if (client_fd != -1) {
       fcntl(client_fd, F_SETFL, O_NONBLOCK);
-      fprintf(stderr, "Accepted successfully.");
-      again = 0;
+      fprintf(stderr, "Accepted successfully.\n");
+      recv_start = recv_end = 0;
+      send_end = 0;
+      return;
     }
+    if (errno != EAGAIN) {
+      fprintf(stderr, "failed to accept on socket: %s (%d)\n", strerror(errno),
+              errno);
+      abort();
+    }
+    // No client waiting to connect right now.
+    wait_for(socket_fd, POLLIN);
   }
 }
 
@@ -109,7 +136,7 @@ void remote_bitbang_t::tick(
 {
   if (client_fd > 0) {
     tdo = jtag_tdo;
-    execute_command();
+    execute_commands();
   } else {
     this->accept();
   }
@@ -131,72 +158,103 @@ void remote_bitbang_t::set_pins(char _tck, char _tms, char _tdi){
   tdi = _tdi;
 }
 
-void remote_bitbang_t::execute_command()
+void remote_bitbang_t::flush_replies()
 {
-  char command;
-  int again = 1;
-  while (again) {
-    ssize_t num_read = read(client_fd, &command, sizeof(command));
-    if (num_read == -1) {
+  ssize_t sent = 0;
+  while (sent < send_end) {
+    ssize_t bytes = write(client_fd, send_buf + sent, send_end - sent);
+    if (bytes == -1) {
       if (errno == EAGAIN) {
-        // We'll try again the next call.
-        //fprintf(stderr, "Received no command. Will try again on the next call\n");
-      } else {
-        fprintf(stderr, "remote_bitbang failed to read on socket: %s (%d)\n",
-                strerror(errno), errno);
-        again = 0;
-        abort();
+        // The client is not keeping up; wait for room in the socket.
+        wait_for(client_fd, POLLOUT);
+        continue;
       }
-    } else if (num_read == 0) {
-      fprintf(stderr, "No Command Received.\n");
-      again = 1;
-    } else {
-      again = 0;
+      fprintf(stderr, "failed to write to socket: %s (%d)\n", strerror(errno), errno);
+      abort();
     }
+    sent += bytes;
   }
+  send_end = 0;
+}
 
-  //fprintf(stderr, "Received a command %c\n", command);
-
-  int dosend = 0;
-
-  char tosend = '?';
-
-  switch (command) {
-  case 'B': /* fprintf(stderr, "*BLINK*\n"); */ break;
-  case 'b': /* fprintf(stderr, "_______\n"); */ break;
-  case 'r': reset(); break; // This is wrong. 'r' has other bits that indicated TRST and SRST.
-  case '0': set_pins(0, 0, 0); break;
-  case '1': set_pins(0, 0, 1); break;
-  case '2': set_pins(0, 1, 0); break;
-  case '3': set_pins(0, 1, 1); break;
-  case '4': set_pins(1, 0, 0); break;
-  case '5': set_pins(1, 0, 1); break;
-  case '6': set_pins(1, 1, 0); break;
-  case '7': set_pins(1, 1, 1); break;
-  case 'R': dosend = 1; tosend = tdo ? '1' : '0'; break;
-  case 'Q': quit = 1; break;
-  default:
-    fprintf(stderr, "remote_bitbang got unsupported command '%c'\n",
-            command);
+bool remote_bitbang_t::receive_commands()
+{
+  // With the core halted the client is the only thing that can make
+  // progress, so there is no point in spinning the model until it does.
+  if (halted) {
+    wait_for(client_fd, POLLIN);
   }
 
-  if (dosend){
-    while (1) {
-      ssize_t bytes = write(client_fd, &tosend, sizeof(tosend));
-      if (bytes == -1) {
-        fprintf(stderr, "failed to write to socket: %s (%d)\n", strerror(errno), errno);
-        abort();
-      }
-      if (bytes > 0) {
-        break;
-      }
+  recv_start = 0;
+  recv_end = read(client_fd, recv_buf, buf_size);
+  if (recv_end == -1) {
+    recv_end = 0;
+    if (errno == EAGAIN) {
+      // We'll try again the next call.
+      return false;
     }
+    fprintf(stderr, "remote_bitbang failed to read on socket: %s (%d)\n",
+            strerror(errno), errno);
+    abort();
   }
 
-  if (quit) {
+  if (recv_end == 0) {
     // The remote disconnected.
     fprintf(stderr, "Remote end disconnected\n");
     close(client_fd);
     client_fd = 0;
+    return false;
+  }
+  return true;
+}
+
+void remote_bitbang_t::execute_commands()
+{
+  while (1) {
+    if (recv_start == recv_end) {
+      // The client may be waiting for the replies before it sends
+      // anything else.
+      flush_replies();
+      if (!receive_commands()) {
+        return;
+      }
+    }
+
+    char command = recv_buf[recv_start++];
+
+    //fprintf(stderr, "Received a command %c\n", command);
+
+    switch (command) {
+    case 'B': /* fprintf(stderr, "*BLINK*\n"); */ break;
+    case 'b': /* fprintf(stderr, "_______\n"); */ break;
+    case 'r': reset(); break; // This is wrong. 'r' has other bits that indicated TRST and SRST.
+    case '0': set_pins(0, 0, 0); return;
+    case '1': set_pins(0, 0, 1); return;
+    case '2': set_pins(0, 1, 0); return;
+    case '3': set_pins(0, 1, 1); return;
+    case '4': set_pins(1, 0, 0); return;
+    case '5': set_pins(1, 0, 1); return;
+    case '6': set_pins(1, 1, 0); return;
+    case '7': set_pins(1, 1, 1); return;
+    case 'R':
+      send_buf[send_end++] = tdo ? '1' : '0';
+      if (send_end == buf_size) {
+        flush_replies();
+      }
+      break;
+    case 'Q': quit = 1; break;
+    default:
+      fprintf(stderr, "remote_bitbang got unsupported command '%c'\n",
+              command);
+    }
+
+    if (quit) {
+      // The remote disconnected.
+      flush_replies();
+      fprintf(stderr, "Remote end disconnected\n");
+      close(client_fd);
+      client_fd = 0;
+      return;
+    }
   }
 }
@@ -24,6 +24,23 @@ public:
 
   int exit_code() {return err;}
 
+  // Pin and exit state, kept in simulation checkpoints. The client
+  // connection itself is not part of it and has to be re-established.
+  struct state_t {
+    unsigned char tck, tms, tdi, trstn, tdo, quit;
+    int err;
+  };
+  state_t get_state() const {return {tck, tms, tdi, trstn, tdo, quit, err};}
+  void set_state(const state_t& s);
+
+  // Tell the server whether the core is halted in debug mode. While it is,
+  // nothing in the simulation moves on its own, so once all buffered
+  // commands are done tick() sleeps in poll() until the client sends more.
+  void set_halted(bool value) {halted = value;}
+
+  // No received command is left to execute and no reply to send.
+  bool idle() const {return recv_start == recv_end && send_end == 0;}
+
  private:
 
   int err;
@@ -34,6 +51,7 @@ public:
   unsigned char trstn;
   unsigned char tdo;
   unsigned char quit;
+  bool halted;
 
   int socket_fd;
   int client_fd;
@@ -41,13 +59,21 @@ public:
   static const ssize_t buf_size = 64 * 1024;
   char recv_buf[buf_size];
   ssize_t recv_start, recv_end;
+  // 'R' replies, sent in one write once the buffered commands run out
+  char send_buf[buf_size];
+  ssize_t send_end;
 
-  // Check for a client connecting, and accept if there is one.
+  // Wait for a client to connect, and accept it.
   void accept();
-  // Execute any commands the client has for us.
-  // But we only execute 1 because we need time for the
-  // simulation to run.
-  void execute_command();
+  // Execute buffered commands up to and including the next pin change,
+  // which the model has to see before the next command can run.
+  void execute_commands();
+  // Refill recv_buf from the client. Returns false if nothing was read.
+  bool receive_commands();
+  // Send the replies collected in send_buf.
+  void flush_replies();
+  // Sleep until poll() reports one of events on fd.
+  void wait_for(int fd, short events);
 
   // Reset. Currently does nothing.
   void reset();
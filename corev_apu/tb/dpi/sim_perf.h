@@ -0,0 +1,41 @@
+// Description: Host-side throughput counters of the simulation harness
+
+#ifndef _SIM_PERF_H
+#define _SIM_PERF_H
+
+#include <chrono>
+#include <stdint.h>
+
+// Host seconds spent in each phase of the simulation and the number of
+// instructions the core retired. Timing is only taken when enabled.
+struct sim_perf_t {
+  bool enabled;
+  uint64_t instret;
+  double eval_s;   // top->eval(), including the DPI calls below
+  double trace_s;  // waveform dumping
+  double dtm_s;    // SimDTM debug_tick
+  double jtag_s;   // SimJTAG jtag_tick
+};
+
+inline sim_perf_t& sim_perf() {
+  static sim_perf_t perf;
+  return perf;
+}
+
+// adds the lifetime of the timer to a phase of sim_perf()
+class sim_perf_timer_t {
+ public:
+  sim_perf_timer_t(double& phase) : phase(sim_perf().enabled ? &phase : nullptr) {
+    if (this->phase)
+      start = std::chrono::steady_clock::now();
+  }
+  ~sim_perf_timer_t() {
+    if (phase)
+      *phase += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  }
+ private:
+  double* phase;
+  std::chrono::steady_clock::time_point start;
+};
+
+#endif
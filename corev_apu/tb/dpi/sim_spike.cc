@@ -8,6 +8,8 @@
 #include <sstream>
 #include <climits>
 #include <cstdlib>
+#include <cstdint>
+#include <cstring>
 #include <cassert>
 #include <signal.h>
 #include <unistd.h>
@@ -20,7 +22,10 @@ sim_spike_t::sim_spike_t(const char* isa, size_t nprocs,
              const std::vector<std::string>& args)
   : mems(mems), procs(std::max(nprocs, size_t(1))),
   current_step(0), current_proc(0), debug(false), log(true),
-    histogram_enabled(false), dtb_enabled(true), remote_bitbang(NULL)
+    histogram_enabled(false), dtb_enabled(true), remote_bitbang(NULL),
+    ring_head(0), ring_tail(0), pending_clint_ticks(0), producer_stop(false),
+    producer_running(false), tick_waiting(false), base(0), undo_log(this),
+    ticks_posted(0), mtip_deadline(SIZE_MAX), synced(false)
 {
 
   for (auto& x : mems)
@@ -31,6 +36,7 @@ sim_spike_t::sim_spike_t(const char* isa, size_t nprocs,
   for (size_t i = 0; i < procs.size(); i++) {
     procs[i] = new processor_t(isa, this, i, false);
   }
+  procs[0]->get_mmu()->register_memtracer(&undo_log);
 
   clint.reset(new clint_t(procs));
   // we need to bring the clint to a reproducible default value
@@ -44,12 +50,155 @@ sim_spike_t::sim_spike_t(const char* isa, size_t nprocs,
 
 sim_spike_t::~sim_spike_t()
 {
+  stop_producer();
   for (size_t i = 0; i < procs.size(); i++)
     delete procs[i];
   delete debug_mmu;
 }
 
 commit_log_t sim_spike_t::tick(size_t n)
+{
+  if (!producer_running)
+    return step_commit(n);
+
+  size_t head = ring_head.load(std::memory_order_relaxed);
+  if (ring_tail.load(std::memory_order_acquire) == head) {
+    tick_waiting.store(true, std::memory_order_release);
+    while (ring_tail.load(std::memory_order_acquire) == head)
+      std::this_thread::yield();
+    tick_waiting.store(false, std::memory_order_relaxed);
+  }
+  commit_log_t commit_log = ring[head & (ring.size() - 1)];
+  ring_head.store(head + 1, std::memory_order_release);
+  return commit_log;
+}
+
+void sim_spike_t::start_producer(size_t depth)
+{
+  assert(depth && (depth & (depth - 1)) == 0);
+  stop_producer();
+  ring.resize(depth);
+  ring_head = 0;
+  ring_tail = 0;
+  ticks_posted = 0;
+  undo_log.enabled = true;
+  // stores that still hit in the TLB would bypass the undo log
+  procs[0]->get_mmu()->flush_tlb();
+  rebase(0);
+  update_mtip_deadline();
+  producer_stop = false;
+  producer_running = true;
+  t1 = std::thread(&sim_spike_t::producer_thread, this);
+}
+
+void sim_spike_t::stop_producer()
+{
+  if (!producer_running)
+    return;
+  producer_stop = true;
+  t1.join();
+  producer_running = false;
+  // drop what ran ahead of tick(): undo the stores since the base, go back
+  // to the hart state there and replay the records tick() already returned
+  undo_log.undo();
+  undo_log.enabled = false;
+  procs[0]->restore_snapshot(base_state);
+  for (size_t i = base; i < ring_head.load(); i++)
+    step_commit(1);
+  clint->increment(pending_clint_ticks.exchange(0));
+}
+
+void sim_spike_t::rebase(size_t index)
+{
+  procs[0]->save_snapshot(base_state);
+  base = index;
+  undo_log.clear();
+}
+
+void sim_spike_t::update_mtip_deadline()
+{
+  size_t posted = ticks_posted;
+  reg_t ticks = clint->ticks_to_mtimecmp(0);
+  mtip_deadline = ticks && ticks < SIZE_MAX - posted ? posted + ticks : SIZE_MAX;
+}
+
+namespace {
+  // unwinds the producer out of an instruction that waits for tick()
+  struct producer_stopped_t {};
+}
+
+void sim_spike_t::sync_with_tick()
+{
+  if (!producer_running)
+    return;
+  size_t tail = ring_tail.load(std::memory_order_relaxed);
+  while (ring_head.load(std::memory_order_acquire) != tail ||
+         !tick_waiting.load(std::memory_order_acquire)) {
+    if (producer_stop.load(std::memory_order_relaxed))
+      throw producer_stopped_t();
+    std::this_thread::yield();
+  }
+  // tick() is blocked, so no more ticks arrive before this record
+  if (size_t ticks = pending_clint_ticks.exchange(0))
+    clint->increment(ticks);
+  synced = true;
+}
+
+// Spike runs on this thread for as long as the producer is enabled, so the
+// processor, the clint and memory are only touched from here meanwhile.
+// The RTL cannot undo instructions Spike already ran, so after a trap or
+// interrupt the producer waits until that record has been consumed before
+// it continues. Timer ticks are applied at the producer's position in the
+// instruction stream, which nothing can tell apart from lockstep: devices
+// are only accessed in lockstep, and a tick that raises MTIP rolls the
+// producer back (see clint_tick()).
+void sim_spike_t::producer_thread()
+{
+  const size_t mask = ring.size() - 1;
+  while (!producer_stop.load(std::memory_order_relaxed)) {
+    size_t tail = ring_tail.load(std::memory_order_relaxed);
+    size_t head = ring_head.load(std::memory_order_acquire);
+    if (tail - head == ring.size()) {
+      std::this_thread::yield();
+      continue;
+    }
+    // keep the replay short, moving the base up once tick() caught up
+    size_t replay = tail - base;
+    if (head == tail && (replay >= ring.size() || replay >= MAX_REPLAY)) {
+      rebase(tail);
+    } else if (replay >= MAX_REPLAY) {
+      std::this_thread::yield();
+      continue;
+    }
+
+    if (size_t ticks = pending_clint_ticks.exchange(0))
+      clint->increment(ticks);
+
+    commit_log_t commit_log;
+    synced = false;
+    try {
+      commit_log = step_commit(1);
+    } catch (producer_stopped_t&) {
+      break;
+    }
+    if (synced) {
+      // tick() waits for this record, so nothing before it is rolled back;
+      // a device access may also have moved mtimecmp or mtime
+      rebase(tail + 1);
+      update_mtip_deadline();
+    }
+    ring[tail & mask] = commit_log;
+    ring_tail.store(tail + 1, std::memory_order_release);
+
+    if (commit_log.was_exception) {
+      while (!producer_stop.load(std::memory_order_relaxed) &&
+             ring_head.load(std::memory_order_acquire) != tail + 1)
+        std::this_thread::yield();
+    }
+  }
+}
+
+commit_log_t sim_spike_t::step_commit(size_t n)
 {
   commit_log_t commit_log;
 
@@ -72,8 +221,27 @@ commit_log_t sim_spike_t::tick(size_t n)
   return commit_log;
 }
 
+size_t sim_spike_t::tick_n(commit_log_t* commit_log, size_t n)
+{
+  for (size_t i = 0; i < n; i++) {
+    commit_log[i] = tick(1);
+    if (commit_log[i].was_exception)
+      return i + 1;
+  }
+  return n;
+}
+
 void sim_spike_t::clint_tick() {
-  clint->increment(1);
+  if (!producer_running) {
+    clint->increment(1);
+    return;
+  }
+  pending_clint_ticks++;
+  // resynchronize: the records after ring_head ran without this interrupt
+  if (++ticks_posted == mtip_deadline.load(std::memory_order_relaxed)) {
+    stop_producer();
+    start_producer(ring.size());
+  }
 }
 
 void sim_spike_t::set_debug(bool value)
@@ -104,6 +272,7 @@ bool sim_spike_t::mmio_load(reg_t addr, size_t len, uint8_t* bytes)
 {
   if (addr + len < addr)
     return false;
+  sync_with_tick();
   return bus.load(addr, len, bytes);
 }
 
@@ -111,6 +280,7 @@ bool sim_spike_t::mmio_store(reg_t addr, size_t len, const uint8_t* bytes)
 {
   if (addr + len < addr)
     return false;
+  sync_with_tick();
   return bus.store(addr, len, bytes);
 }
 
@@ -127,9 +297,20 @@ void sim_spike_t::make_bootrom()
 }
 
 char* sim_spike_t::addr_to_mem(reg_t addr) {
-  auto desc = bus.find_device(addr);
-  if (auto mem = dynamic_cast<mem_t*>(desc.second))
-    if (addr - desc.first < mem->size())
-      return mem->contents() + (addr - desc.first);
-  return NULL;
-}
\ No newline at end of file
+  return bus.addr_to_mem(addr);
+}
+
+void sim_spike_t::undo_log_t::trace(uint64_t addr, size_t bytes, access_type type)
+{
+  entry_t e = {sim->addr_to_mem(addr), 0, bytes};
+  assert(bytes <= sizeof(e.data));
+  memcpy(&e.data, e.host, bytes);
+  log.push_back(e);
+}
+
+void sim_spike_t::undo_log_t::undo()
+{
+  for (auto e = log.rbegin(); e != log.rend(); ++e)
+    memcpy(e->host, &e->data, e->len);
+  log.clear();
+}
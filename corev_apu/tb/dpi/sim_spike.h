@@ -7,12 +7,14 @@
 #include "devices.h"
 #include "debug_module.h"
 #include "simif.h"
+#include "memtracer.h"
 #include <fesvr/htif.h>
 #include <fesvr/context.h>
 #include <vector>
 #include <string>
 #include <memory>
 #include <thread>
+#include <atomic>
 
 class mmu_t;
 class remote_bitbang_t;
@@ -38,9 +40,17 @@ public:
   ~sim_spike_t();
 
   int init_sim();
+  // run Spike on a background thread, up to depth records (a power of 2)
+  // ahead of tick(); tick() then only dequeues the next record
+  void start_producer(size_t depth);
+  // back to lockstep, with Spike rolled back to the last record tick() took
+  void stop_producer();
   void producer_thread();
   void clint_tick();
   commit_log_t tick(size_t n); // step through simulation
+  // retire up to n instructions into commit_log[], one record each; the
+  // batch ends early after a trap so the caller can resynchronize
+  size_t tick_n(commit_log_t* commit_log, size_t n);
   void set_debug(bool value);
   void set_log(bool value);
   void set_histogram(bool value);
@@ -86,6 +96,61 @@ private:
   void proc_reset(unsigned id) {};
 
   void make_bootrom();
+  commit_log_t step_commit(size_t n);
+
+  // single-producer/single-consumer ring of look-ahead commit records;
+  // ring_tail is only written by t1, ring_head only by the tick() caller
+  std::vector<commit_log_t> ring;
+  std::atomic<size_t> ring_head;
+  std::atomic<size_t> ring_tail;
+  std::atomic<size_t> pending_clint_ticks;
+  std::atomic<bool> producer_stop;
+  bool producer_running;
+  std::atomic<bool> tick_waiting; // tick() waits for the record at ring_head
+
+  // saves the bytes each store to memory overwrites while enabled
+  class undo_log_t : public memtracer_t
+  {
+   public:
+    undo_log_t(simif_t* sim) : enabled(false), sim(sim) {}
+    bool interested_in_range(uint64_t begin, uint64_t end, access_type type)
+    {
+      return enabled && type == STORE;
+    }
+    void trace(uint64_t addr, size_t bytes, access_type type);
+    void undo(); // newest store first
+    void clear() { log.clear(); }
+    bool enabled;
+   private:
+    struct entry_t {
+      char* host;
+      uint64_t data;
+      size_t len;
+    };
+    simif_t* sim;
+    std::vector<entry_t> log;
+  };
+
+  // The hart as it was before record `base' and the stores since then, which
+  // is where stop_producer() rolls back to before it replays up to ring_head.
+  // The base moves up whenever tick() caught up with the producer.
+  static const size_t MAX_REPLAY = 65536;
+  processor_t::snapshot_t base_state;
+  size_t base;
+  undo_log_t undo_log;
+  void rebase(size_t index);
+
+  // clint_tick() calls since the producer started, and how many of them
+  // make mtime reach mtimecmp; the records Spike ran ahead of that tick
+  // did not see the timer interrupt, so the tick resynchronizes
+  std::atomic<size_t> ticks_posted;
+  std::atomic<size_t> mtip_deadline;
+  void update_mtip_deadline();
+
+  // devices are not rolled back and read the current mtime, so the producer
+  // only accesses them once tick() waits for that very record
+  bool synced;
+  void sync_with_tick();
 
 public:
 
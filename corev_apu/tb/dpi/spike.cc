@@ -20,6 +20,7 @@
 #include <unistd.h>
 #include <map>
 #include <iostream>
+#include <stdexcept>
 
 sim_spike_t* sim;
 std::vector<std::pair<reg_t, mem_t*>> mem;
@@ -28,8 +29,23 @@ commit_log_t commit_log_val;
 #define SHT_PROGBITS 0x1
 #define SHT_GROUP 0x11
 
-void write_spike_mem (reg_t address, size_t len, uint8_t* buf) {
-    memcpy(mem[0].second->contents() + (address & ~(1 << 31)), buf,len);
+// place len bytes at file offset of the ELF into Spike's memory; segments
+// entirely outside of it are left out, as Spike has nothing to load them into
+void write_spike_mem (reg_t address, size_t len, int fd, off_t offset) {
+    reg_t base = mem[0].first, size = mem[0].second->size();
+    if (address + len <= base || address >= base + size)
+      return;
+    if (address < base || address + len > base + size) {
+      fprintf(stderr, "spike: ELF segment 0x%lx+0x%lx is only partly inside memory\n",
+              (unsigned long)address, (unsigned long)len);
+      exit(1);
+    }
+    try {
+      mem[0].second->load_file(fd, offset, address - base, len);
+    } catch (std::runtime_error& e) {
+      fprintf(stderr, "spike: %s\n", e.what());
+      exit(1);
+    }
 }
 
 void read_elf(const char* filename) {
@@ -42,7 +58,6 @@ void read_elf(const char* filename) {
 
     char* buf = (char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
     assert(buf != MAP_FAILED);
-    close(fd);
 
     assert(size >= sizeof(Elf64_Ehdr));
     const Elf64_Ehdr* eh64 = (const Elf64_Ehdr*)buf;
@@ -58,7 +73,7 @@ void read_elf(const char* filename) {
       if(ph[i].p_type == PT_LOAD && ph[i].p_memsz) { \
         if (ph[i].p_filesz) { \
           assert(size >= ph[i].p_offset + ph[i].p_filesz); \
-          write_spike_mem(ph[i].p_paddr, ph[i].p_filesz, (uint8_t*)buf + ph[i].p_offset); \
+          write_spike_mem(ph[i].p_paddr, ph[i].p_filesz, fd, ph[i].p_offset); \
         } \
         zeros.resize(ph[i].p_memsz - ph[i].p_filesz); \
       } \
@@ -96,21 +111,34 @@ void read_elf(const char* filename) {
     LOAD_ELF(Elf64_Ehdr, Elf64_Phdr, Elf64_Shdr, Elf64_Sym);
 
   munmap(buf, size);
+  close(fd);
 }
 
-extern "C" void spike_create(const char* filename, uint64_t dram_base, unsigned int size)
+extern "C" void spike_create(const char* filename, uint64_t dram_base, uint64_t size)
 {
 
     mem = std::vector<std::pair<reg_t, mem_t*>>(1, std::make_pair(reg_t(dram_base), new mem_t(size)));
-    // zero out memory
-    memset(mem[0].second->contents(), 0, size_t(size));
-
+    // fresh memory reads as zero, so only the ELF segments are written
     read_elf(filename);
 
     if (!sim) {
       std::vector<std::string> htif_args = sanitize_args();
 
       sim = new sim_spike_t("rv64imac", 1, mem, htif_args);
+
+      // +spike_lookahead=<depth> lets Spike run ahead of the RTL on its own thread
+      for (auto& arg : htif_args) {
+        if (arg.find("+spike_lookahead=") != 0)
+          continue;
+        const char* val = arg.c_str() + strlen("+spike_lookahead=");
+        char* end;
+        unsigned long depth = strtoul(val, &end, 0);
+        if (!*val || *end || !depth || (depth & (depth - 1))) {
+          fprintf(stderr, "spike: +spike_lookahead=%s is not a power of 2\n", val);
+          exit(1);
+        }
+        sim->start_producer(depth);
+      }
     }
 }
 
@@ -127,6 +155,14 @@ extern "C" void spike_tick(commit_log_t* commit_log)
   commit_log->was_exception = commit_log_val.was_exception;
 }
 
+// advance Spike by up to n instructions and get all retired instructions in
+// one call; returns the number of records written, which is less than n if
+// an instruction trapped
+extern "C" int spike_tick_n(commit_log_t* commit_log, unsigned int n)
+{
+  return sim->tick_n(commit_log, n);
+}
+
 extern "C" void clint_tick()
 {
   sim->clint_tick();
@@ -4,6 +4,13 @@
 #include "verilated_vcd_c.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 extern bool verbose;
 extern bool done_reset;
@@ -26,4 +33,126 @@ class VerilatedVcdFILE : public VerilatedVcdFile {
   FILE* file;
 };
 
+// Hands the trace to a writer thread through a bounded queue, so that
+// compression and file I/O overlap with the model evaluation. With compress
+// set the file is written as gzip. finish() drains the queue and must be
+// called before the FILE is closed.
+class VerilatedVcdAsync : public VerilatedVcdFile {
+ public:
+  VerilatedVcdAsync(FILE* file, bool compress)
+    : file(file), gz(NULL), queued(0), done(false) {
+    if (file && compress)
+      gz = gzdopen(dup(fileno(file)), "wb");
+    writer = std::thread(&VerilatedVcdAsync::run, this);
+  }
+  ~VerilatedVcdAsync() { finish(); }
+  bool open(const std::string& name) override {
+    // file should already be open
+    return file != NULL;
+  }
+  void close() override {
+    // file should be closed elsewhere
+  }
+  ssize_t write(const char* bufp, ssize_t len) override {
+    std::unique_lock<std::mutex> lock(mutex);
+    space.wait(lock, [&] { return queued < max_queued; });
+    chunks.emplace_back(bufp, len);
+    queued += len;
+    ready.notify_one();
+    return len;
+  }
+  void finish() {
+    if (!writer.joinable())
+      return;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      done = true;
+    }
+    ready.notify_one();
+    writer.join();
+    if (gz)
+      gzclose(gz);
+    else if (file)
+      fflush(file);
+  }
+ private:
+  static const size_t max_queued = 64 << 20;
+  FILE* file;
+  gzFile gz;
+  std::thread writer;
+  std::mutex mutex;
+  std::condition_variable ready, space;
+  std::deque<std::string> chunks;
+  size_t queued;
+  bool done;
+
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      ready.wait(lock, [&] { return done || !chunks.empty(); });
+      if (chunks.empty())
+        return;
+      std::string chunk;
+      chunk.swap(chunks.front());
+      chunks.pop_front();
+      lock.unlock();
+      if (gz)
+        gzwrite(gz, chunk.data(), chunk.size());
+      else if (file)
+        fwrite(chunk.data(), 1, chunk.size(), file);
+      lock.lock();
+      queued -= chunk.size();
+      space.notify_one();
+    }
+  }
+};
+
+// Keeps the trace in memory as segments started by VerilatedVcdC::openNext()
+// and on flush() writes only the last two of them, i.e. the final cycles
+// before the end of the run. Only the first segment, from open(), carries the
+// VCD header with the signal definitions; it is split off and kept for the
+// whole run, then written ahead of the two segments. Every segment starts
+// with a full dump of all signals, so the older one is complete on its own.
+class VerilatedVcdRING : public VerilatedVcdFile {
+ public:
+  VerilatedVcdRING(VerilatedVcdFile* sink) : sink(sink) {}
+  ~VerilatedVcdRING() {}
+  bool open(const std::string& name) override {
+    take_header();
+    prev.swap(cur);
+    cur.clear();
+    return sink->open(name);
+  }
+  void close() override {
+    // the segments are written by flush()
+  }
+  ssize_t write(const char* bufp, ssize_t len) override {
+    cur.append(bufp, len);
+    return len;
+  }
+  void flush() {
+    take_header();
+    sink->write(header.data(), header.size());
+    sink->write(prev.data(), prev.size());
+    sink->write(cur.data(), cur.size());
+    prev.clear();
+    cur.clear();
+  }
+ private:
+  VerilatedVcdFile* sink;
+  std::string header, prev, cur;
+
+  // move the header out of the first segment once it has been written
+  void take_header() {
+    static const std::string end_header = "$enddefinitions $end\n";
+    if (!header.empty())
+      return;
+    size_t pos = cur.find(end_header);
+    if (pos == std::string::npos)
+      return;
+    header = cur.substr(0, pos + end_header.size());
+    cur.erase(0, pos + end_header.size());
+  }
+};
+
 #endif
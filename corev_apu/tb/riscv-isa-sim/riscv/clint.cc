@@ -26,10 +26,11 @@ void clint_t::reset() {
 
 bool clint_t::load(reg_t addr, size_t len, uint8_t* bytes)
 {
+  std::lock_guard<std::mutex> guard(lock);
   if (addr >= MSIP_BASE && addr + len <= MSIP_BASE + procs.size()*sizeof(msip_t)) {
     std::vector<msip_t> msip(procs.size());
     for (size_t i = 0; i < procs.size(); ++i)
-      msip[i] = !!(procs[i]->state.mip & MIP_MSIP);
+      msip[i] = !!(procs[i]->state.get_mip() & MIP_MSIP);
     memcpy(bytes, (uint8_t*)&msip[0] + addr - MSIP_BASE, len);
   } else if (addr >= MTIMECMP_BASE && addr + len <= MTIMECMP_BASE + procs.size()*sizeof(mtimecmp_t)) {
     memcpy(bytes, (uint8_t*)&mtimecmp[0] + addr - MTIMECMP_BASE, len);
@@ -43,6 +44,7 @@ bool clint_t::load(reg_t addr, size_t len, uint8_t* bytes)
 
 bool clint_t::store(reg_t addr, size_t len, const uint8_t* bytes)
 {
+  std::lock_guard<std::mutex> guard(lock);
   if (addr >= MSIP_BASE && addr + len <= MSIP_BASE + procs.size()*sizeof(msip_t)) {
     std::vector<msip_t> msip(procs.size());
     std::vector<msip_t> mask(procs.size(), 0);
@@ -50,9 +52,7 @@ bool clint_t::store(reg_t addr, size_t len, const uint8_t* bytes)
     memset((uint8_t*)&mask[0] + addr - MSIP_BASE, 0xff, len);
     for (size_t i = 0; i < procs.size(); ++i) {
       if (!(mask[i] & 0xFF)) continue;
-      procs[i]->state.mip &= ~MIP_MSIP;
-      if (!!(msip[i] & 1))
-        procs[i]->state.mip |= MIP_MSIP;
+      procs[i]->state.set_mip(MIP_MSIP, (msip[i] & 1) ? MIP_MSIP : 0);
     }
   } else if (addr >= MTIMECMP_BASE && addr + len <= MTIMECMP_BASE + procs.size()*sizeof(mtimecmp_t)) {
     memcpy((uint8_t*)&mtimecmp[0] + addr - MTIMECMP_BASE, bytes, len);
@@ -61,16 +61,25 @@ bool clint_t::store(reg_t addr, size_t len, const uint8_t* bytes)
   } else {
     return false;
   }
-  increment(0);
+  update_mtip();
   return true;
 }
 
 void clint_t::increment(reg_t inc)
 {
+  std::lock_guard<std::mutex> guard(lock);
   mtime += inc;
-  for (size_t i = 0; i < procs.size(); i++) {
-    procs[i]->state.mip &= ~MIP_MTIP;
-    if (mtime >= mtimecmp[i])
-      procs[i]->state.mip |= MIP_MTIP;
-  }
+  update_mtip();
+}
+
+reg_t clint_t::ticks_to_mtimecmp(size_t i)
+{
+  std::lock_guard<std::mutex> guard(lock);
+  return mtime >= mtimecmp[i] ? 0 : mtimecmp[i] - mtime;
+}
+
+void clint_t::update_mtip()
+{
+  for (size_t i = 0; i < procs.size(); i++)
+    procs[i]->state.set_mip(MIP_MTIP, mtime >= mtimecmp[i] ? MIP_MTIP : 0);
 }
@@ -1,4 +1,5 @@
 #include <cassert>
+#include <cstring>
 
 #include "debug_module.h"
 #include "debug_defines.h"
@@ -309,6 +310,110 @@ void debug_module_t::sb_write()
   }
 }
 
+// Host memory backing [addr, addr + len), or NULL unless the whole range
+// is plain memory that the block transfers can copy directly.
+char *debug_module_t::sb_host_range(reg_t addr, size_t len)
+{
+  if (len == 0 || addr + len < addr)
+    return NULL;
+  char *start = sim->addr_to_mem(addr);
+  if (!start || sim->addr_to_mem(addr + len - 1) != start + len - 1)
+    return NULL;
+  return start;
+}
+
+size_t debug_module_t::sb_write_block(const uint8_t *data, size_t len)
+{
+  if (sbcs.sbaccess > 3 || sb_access_bits() > max_bus_master_bits) {
+    // unsupported access size, reported the same way sb_write() does
+    if (sbcs.error == 0)
+      sbcs.error = 3;
+    return 0;
+  }
+  size_t size = sb_access_bits() / 8;
+  size_t count = len / size;
+  if (count == 0 || sbcs.error != 0)
+    return 0;
+
+  reg_t address = ((uint64_t) sbaddress[1] << 32) | sbaddress[0];
+  char *host = sbcs.autoincrement ? sb_host_range(address, count * size) : NULL;
+  if (host) {
+    // Same end state as the loop below: memory written, sbdata holding the
+    // last word and sbaddress pointing past it.
+    memcpy(host, data, count * size);
+    const uint8_t *last = data + (count - 1) * size;
+    uint64_t value = 0;
+    memcpy(&value, last, size);
+    sbdata[0] = value;
+    if (size == 8)
+      sbdata[1] = value >> 32;
+    address += count * size;
+    sbaddress[0] = address;
+    sbaddress[1] = address >> 32;
+    return count * size;
+  }
+
+  size_t done = 0;
+  for (size_t i = 0; i < count && sbcs.error == 0; i++) {
+    uint64_t value = 0;
+    memcpy(&value, data + i * size, size);
+    if (size == 8)
+      sbdata[1] = value >> 32;
+    sbdata[0] = value;
+    sb_write();
+    if (sbcs.error != 0)
+      break;
+    if (sbcs.autoincrement)
+      sb_autoincrement();
+    done += size;
+  }
+  return done;
+}
+
+size_t debug_module_t::sb_read_block(uint8_t *data, size_t len)
+{
+  if (sbcs.sbaccess > 3 || sb_access_bits() > max_bus_master_bits) {
+    // unsupported access size, reported the same way sb_read() does
+    if (sbcs.error == 0)
+      sbcs.error = 3;
+    return 0;
+  }
+  size_t size = sb_access_bits() / 8;
+  size_t count = len / size;
+  if (count == 0 || sbcs.error != 0)
+    return 0;
+
+  // Every read of sbdata0 returns what is already in sbdata, then advances
+  // the address and, with readondata, fetches the next word. Only words
+  // 1..count-1 come from memory, so copy those directly if we can and
+  // leave the final read-ahead to sb_read().
+  reg_t address = ((uint64_t) sbaddress[1] << 32) | sbaddress[0];
+  char *host = NULL;
+  if (sbcs.autoincrement && sbcs.readondata && count > 1)
+    host = sb_host_range(address + size, (count - 1) * size);
+  if (host) {
+    uint64_t value = ((uint64_t) sbdata[1] << 32) | sbdata[0];
+    memcpy(data, &value, size);
+    memcpy(data + size, host, (count - 1) * size);
+    address += count * size;
+    sbaddress[0] = address;
+    sbaddress[1] = address >> 32;
+    sb_read();
+    return count * size;
+  }
+
+  size_t done = 0;
+  for (size_t i = 0; i < count && sbcs.error == 0; i++) {
+    uint64_t value = ((uint64_t) sbdata[1] << 32) | sbdata[0];
+    memcpy(data + i * size, &value, size);
+    done += size;
+    sb_autoincrement();
+    if (sbcs.readondata)
+      sb_read();
+  }
+  return done;
+}
+
 bool debug_module_t::dmi_read(unsigned address, uint32_t *value)
 {
   uint32_t result = 0;
@@ -488,6 +593,94 @@ bool debug_module_t::dmi_read(unsigned address, uint32_t *value)
   return true;
 }
 
+// Perform the transfer part of an Access Register command directly on the
+// state of the halted hart, the way the instructions the abstract command
+// would otherwise run leave it. Returns false if the command has to go
+// through the debug ROM after all, because the access would not be a plain
+// register access there (e.g. ld on RV32 or an FPR with FS off, which
+// trap).
+bool debug_module_t::access_register(bool write, unsigned size, unsigned regno)
+{
+  processor_t *p = current_proc();
+  if (!p || (size != 2 && size != 3))
+    return false;
+  state_t *state = p->get_state();
+  reg_t xlen = p->get_xlen();
+
+  if (regno >= 0x1000 && regno < 0x1020) {
+    unsigned regnum = regno - 0x1000;
+    if (size == 3 && xlen != 64)
+      return false;
+    // The hart waits in the debug ROM with s0 stashed in dscratch.
+    reg_t value = regnum == 8 ? state->dscratch : state->XPR[regnum];
+    if (write) {
+      if (size == 2)
+        value = (sreg_t) (int32_t) read32(dmdata, 0);
+      else
+        value = read32(dmdata, 0) | ((reg_t) read32(dmdata, 1) << 32);
+      if (regnum == 8)
+        state->dscratch = value;
+      else
+        state->XPR.write(regnum, value);
+    } else {
+      write32(dmdata, 0, value);
+      if (size == 3)
+        write32(dmdata, 1, value >> 32);
+    }
+    return true;
+  }
+
+  if (regno >= 0x1020 && regno < 0x1040) {
+    unsigned fprnum = regno - 0x1020;
+    if (!p->supports_extension(size == 3 ? 'D' : 'F') ||
+        (state->mstatus & MSTATUS_FS) == 0)
+      return false;
+    if (write) {
+      if (size == 2)
+        DO_WRITE_FREG(fprnum, freg(f32(read32(dmdata, 0))));
+      else
+        DO_WRITE_FREG(fprnum, freg(f64(read32(dmdata, 0) |
+                ((uint64_t) read32(dmdata, 1) << 32))));
+    } else {
+      freg_t value = state->FPR[fprnum];
+      write32(dmdata, 0, value.v[0]);
+      if (size == 3)
+        write32(dmdata, 1, value.v[0] >> 32);
+    }
+    return true;
+  }
+
+  // The debug ROM path borrows s0 through dscratch, leave that one to it.
+  if (regno < 0x1000 && regno != CSR_DSCRATCH) {
+    if (size == 3 && xlen != 64)
+      return false;
+    try {
+      if (write) {
+        // As csrw: read-only CSRs trap, and so do ones that can't be read.
+        if (get_field(regno, 0xC00) == 3)
+          throw trap_illegal_instruction(0);
+        p->get_csr(regno);
+        reg_t value = read32(dmdata, 0);
+        if (size == 2)
+          value = (sreg_t) (int32_t) value;
+        else
+          value |= (reg_t) read32(dmdata, 1) << 32;
+        p->set_csr(regno, value);
+      } else {
+        reg_t value = p->get_csr(regno);
+        write32(dmdata, 0, value);
+        if (size == 3)
+          write32(dmdata, 1, value >> 32);
+      }
+    } catch (trap_t& t) {
+      abstractcs.cmderr = CMDERR_EXCEPTION;
+    }
+    return true;
+  }
+
+  return false;
+}
+
 bool debug_module_t::perform_abstract_command()
 {
   if (abstractcs.cmderr != CMDERR_NONE)
@@ -509,7 +702,16 @@ bool debug_module_t::perform_abstract_command()
     }
 
     unsigned i = 0;
-    if (get_field(command, AC_ACCESS_REGISTER_TRANSFER)) {
+    bool transfer = get_field(command, AC_ACCESS_REGISTER_TRANSFER);
+    if (transfer && (regno < 0x1000 ? progbufsize < 2 : regno < 0x1040) &&
+        access_register(write, size, regno)) {
+      // Done without running any code on the hart, which only needs to be
+      // sent off if the command also executes the program buffer.
+      if (abstractcs.cmderr != CMDERR_NONE ||
+          !get_field(command, AC_ACCESS_REGISTER_POSTEXEC))
+        return true;
+
+    } else if (transfer) {
 
       if (regno < 0x1000 && progbufsize < 2) {
         // Make the debugger use the program buffer if it's available, so it
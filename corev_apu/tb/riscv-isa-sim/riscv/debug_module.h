@@ -100,6 +100,15 @@ class debug_module_t : public abstract_device_t
     // Called when one of the attached harts was reset.
     void proc_reset(unsigned id);
 
+    // Bulk System Bus Access. Equivalent to len / (sbaccess bytes) writes
+    // of sbdata0 (reads of sbdata0) with the current sbcs and sbaddress,
+    // including autoincrement, readondata and the read-ahead this leaves in
+    // sbdata. data holds the words in little-endian memory order, len must
+    // be a multiple of the access size. Returns the number of bytes
+    // transferred, which is short once sberror gets set.
+    size_t sb_write_block(const uint8_t *data, size_t len);
+    size_t sb_read_block(uint8_t *data, size_t len);
+
   private:
     static const unsigned datasize = 2;
     // Size of program_buffer in 32-bit words, as exposed to the rest of the
@@ -142,6 +151,7 @@ class debug_module_t : public abstract_device_t
     void sb_read();
     void sb_write();
     unsigned sb_access_bits();
+    char *sb_host_range(reg_t addr, size_t len);
 
     dmcontrol_t dmcontrol;
     dmstatus_t dmstatus;
@@ -159,6 +169,7 @@ class debug_module_t : public abstract_device_t
     processor_t *current_proc() const;
     void reset();
     bool perform_abstract_command();
+    bool access_register(bool write, unsigned size, unsigned regno);
 };
 
 #endif
@@ -63,38 +63,47 @@ const int NCSR = 4096;
 #define PC_ALIGN 2
 
 typedef uint64_t insn_bits_t;
+
+// An instruction together with its register specifiers and immediate,
+// extracted once when the instruction is fetched into the instruction
+// cache.  Only the immediate of the instruction's own format is kept, so
+// e.g. s_imm() is meaningful for stores only; RVC formats that depend on
+// XLEN (c.flw/c.ld, c.jal/c.addiw, ...) are resolved by the xlen argument,
+// which callers must always pass so that RV32 code is not decoded as RV64.
 class insn_t
 {
 public:
   insn_t() = default;
-  insn_t(insn_bits_t bits) : b(bits) {}
+  insn_t(insn_bits_t bits, unsigned xlen)
+    : b(bits), imm(decode_imm(xlen)),
+      rd_(x(7, 5)), rs1_(x(15, 5)), rs2_(x(20, 5)), rs3_(x(27, 5)) {}
   insn_bits_t bits() { return b; }
   int length() { return insn_length(b); }
-  int64_t i_imm() { return int64_t(b) >> 20; }
+  int64_t i_imm() { return imm; }
   int64_t shamt() { return x(20, 6); }
-  int64_t s_imm() { return x(7, 5) + (xs(25, 7) << 5); }
-  int64_t sb_imm() { return (x(8, 4) << 1) + (x(25,6) << 5) + (x(7,1) << 11) + (imm_sign() << 12); }
-  int64_t u_imm() { return int64_t(b) >> 12 << 12; }
-  int64_t uj_imm() { return (x(21, 10) << 1) + (x(20, 1) << 11) + (x(12, 8) << 12) + (imm_sign() << 20); }
-  uint64_t rd() { return x(7, 5); }
-  uint64_t rs1() { return x(15, 5); }
-  uint64_t rs2() { return x(20, 5); }
-  uint64_t rs3() { return x(27, 5); }
+  int64_t s_imm() { return imm; }
+  int64_t sb_imm() { return imm; }
+  int64_t u_imm() { return imm; }
+  int64_t uj_imm() { return imm; }
+  uint64_t rd() { return rd_; }
+  uint64_t rs1() { return rs1_; }
+  uint64_t rs2() { return rs2_; }
+  uint64_t rs3() { return rs3_; }
   uint64_t rm() { return x(12, 3); }
   uint64_t csr() { return x(20, 12); }
 
-  int64_t rvc_imm() { return x(2, 5) + (xs(12, 1) << 5); }
-  int64_t rvc_zimm() { return x(2, 5) + (x(12, 1) << 5); }
-  int64_t rvc_addi4spn_imm() { return (x(6, 1) << 2) + (x(5, 1) << 3) + (x(11, 2) << 4) + (x(7, 4) << 6); }
-  int64_t rvc_addi16sp_imm() { return (x(6, 1) << 4) + (x(2, 1) << 5) + (x(5, 1) << 6) + (x(3, 2) << 7) + (xs(12, 1) << 9); }
-  int64_t rvc_lwsp_imm() { return (x(4, 3) << 2) + (x(12, 1) << 5) + (x(2, 2) << 6); }
-  int64_t rvc_ldsp_imm() { return (x(5, 2) << 3) + (x(12, 1) << 5) + (x(2, 3) << 6); }
-  int64_t rvc_swsp_imm() { return (x(9, 4) << 2) + (x(7, 2) << 6); }
-  int64_t rvc_sdsp_imm() { return (x(10, 3) << 3) + (x(7, 3) << 6); }
-  int64_t rvc_lw_imm() { return (x(6, 1) << 2) + (x(10, 3) << 3) + (x(5, 1) << 6); }
-  int64_t rvc_ld_imm() { return (x(10, 3) << 3) + (x(5, 2) << 6); }
-  int64_t rvc_j_imm() { return (x(3, 3) << 1) + (x(11, 1) << 4) + (x(2, 1) << 5) + (x(7, 1) << 6) + (x(6, 1) << 7) + (x(9, 2) << 8) + (x(8, 1) << 10) + (xs(12, 1) << 11); }
-  int64_t rvc_b_imm() { return (x(3, 2) << 1) + (x(10, 2) << 3) + (x(2, 1) << 5) + (x(5, 2) << 6) + (xs(12, 1) << 8); }
+  int64_t rvc_imm() { return imm; }
+  int64_t rvc_zimm() { return imm; }
+  int64_t rvc_addi4spn_imm() { return imm; }
+  int64_t rvc_addi16sp_imm() { return imm; }
+  int64_t rvc_lwsp_imm() { return imm; }
+  int64_t rvc_ldsp_imm() { return imm; }
+  int64_t rvc_swsp_imm() { return imm; }
+  int64_t rvc_sdsp_imm() { return imm; }
+  int64_t rvc_lw_imm() { return imm; }
+  int64_t rvc_ld_imm() { return imm; }
+  int64_t rvc_j_imm() { return imm; }
+  int64_t rvc_b_imm() { return imm; }
   int64_t rvc_simm3() { return x(10, 3); }
   uint64_t rvc_rd() { return rd(); }
   uint64_t rvc_rs1() { return rd(); }
@@ -103,9 +112,85 @@ public:
   uint64_t rvc_rs2s() { return 8 + x(2, 3); }
 private:
   insn_bits_t b;
+  int32_t imm;
+  uint8_t rd_, rs1_, rs2_, rs3_;
   uint64_t x(int lo, int len) { return (b >> lo) & ((insn_bits_t(1) << len)-1); }
   uint64_t xs(int lo, int len) { return int64_t(b) << (64-lo-len) >> (64-len); }
   uint64_t imm_sign() { return xs(63, 1); }
+
+  int64_t decode_imm(unsigned xlen)
+  {
+    if ((b & 0x3) == 0x3) {
+      switch (b & 0x7f) {
+        case 0x23: // STORE
+        case 0x27: // STORE-FP
+          return x(7, 5) + (xs(25, 7) << 5);
+        case 0x63: // BRANCH
+          return (x(8, 4) << 1) + (x(25,6) << 5) + (x(7,1) << 11) + (imm_sign() << 12);
+        case 0x17: // AUIPC
+        case 0x37: // LUI
+          return int64_t(b) >> 12 << 12;
+        case 0x6f: // JAL
+          return (x(21, 10) << 1) + (x(20, 1) << 11) + (x(12, 8) << 12) + (imm_sign() << 20);
+        default:
+          return int64_t(b) >> 20;
+      }
+    }
+
+    bool rv32 = xlen == 32;
+    switch ((x(13, 3) << 2) | (b & 0x3)) {
+      case 0x00: // c.addi4spn
+        return (x(6, 1) << 2) + (x(5, 1) << 3) + (x(11, 2) << 4) + (x(7, 4) << 6);
+      case 0x08: // c.lw
+      case 0x18: // c.sw
+        return (x(6, 1) << 2) + (x(10, 3) << 3) + (x(5, 1) << 6);
+      case 0x0c: // c.flw, c.ld
+      case 0x1c: // c.fsw, c.sd
+        if (rv32)
+          return (x(6, 1) << 2) + (x(10, 3) << 3) + (x(5, 1) << 6);
+        // fall through
+      case 0x04: // c.fld
+      case 0x14: // c.fsd
+        return (x(10, 3) << 3) + (x(5, 2) << 6);
+      case 0x05: // c.jal, c.addiw
+        if (!rv32)
+          return x(2, 5) + (xs(12, 1) << 5);
+        // fall through
+      case 0x15: // c.j
+        return (x(3, 3) << 1) + (x(11, 1) << 4) + (x(2, 1) << 5) + (x(7, 1) << 6) + (x(6, 1) << 7) + (x(9, 2) << 8) + (x(8, 1) << 10) + (xs(12, 1) << 11);
+      case 0x0d: // c.lui, c.addi16sp
+        if (x(7, 5) == X_SP)
+          return (x(6, 1) << 4) + (x(2, 1) << 5) + (x(5, 1) << 6) + (x(3, 2) << 7) + (xs(12, 1) << 9);
+        return x(2, 5) + (xs(12, 1) << 5);
+      case 0x11: // c.srli, c.srai, c.andi, c.sub, ...
+        if (x(10, 2) == 2)
+          return x(2, 5) + (xs(12, 1) << 5);
+        // fall through
+      case 0x02: // c.slli
+        return x(2, 5) + (x(12, 1) << 5);
+      case 0x19: // c.beqz
+      case 0x1d: // c.bnez
+        return (x(3, 2) << 1) + (x(10, 2) << 3) + (x(2, 1) << 5) + (x(5, 2) << 6) + (xs(12, 1) << 8);
+      case 0x06: // c.fldsp
+        return (x(5, 2) << 3) + (x(12, 1) << 5) + (x(2, 3) << 6);
+      case 0x0a: // c.lwsp
+        return (x(4, 3) << 2) + (x(12, 1) << 5) + (x(2, 2) << 6);
+      case 0x0e: // c.flwsp, c.ldsp
+        if (rv32)
+          return (x(4, 3) << 2) + (x(12, 1) << 5) + (x(2, 2) << 6);
+        return (x(5, 2) << 3) + (x(12, 1) << 5) + (x(2, 3) << 6);
+      case 0x16: // c.fsdsp
+        return (x(10, 3) << 3) + (x(7, 3) << 6);
+      case 0x1a: // c.swsp
+        return (x(9, 4) << 2) + (x(7, 2) << 6);
+      case 0x1e: // c.fswsp, c.sdsp
+        if (rv32)
+          return (x(9, 4) << 2) + (x(7, 2) << 6);
+        return (x(10, 3) << 3) + (x(7, 3) << 6);
+      default: // c.addi, c.li, ...
+        return x(2, 5) + (xs(12, 1) << 5);
+    }
+  }
 };
 
 template <class T, size_t N, bool zero_reg>
@@ -1,50 +1,85 @@
 #include "devices.h"
+#include <algorithm>
+#include <stdexcept>
+#include <unistd.h>
 
 void bus_t::add_device(reg_t addr, abstract_device_t* dev)
 {
-  // Searching devices via lower_bound/upper_bound
-  // implicitly relies on the underlying std::map 
-  // container to sort the keys and provide ordered
-  // iteration over this sort, which it does. (python's
-  // SortedDict is a good analogy)
   devices[addr] = dev;
+
+  // Devices are registered once at start-up, so compile the map into a
+  // sorted array that is cheap to search and needs no RTTI per access.
+  regions.clear();
+  for (auto& d : devices) {
+    region_t r = {d.first, d.second, NULL, 0};
+    if (auto mem = dynamic_cast<mem_t*>(d.second)) {
+      r.host = mem->contents();
+      r.host_size = mem->size();
+    }
+    regions.push_back(r);
+  }
 }
 
-bool bus_t::load(reg_t addr, size_t len, uint8_t* bytes)
+const bus_t::region_t* bus_t::find_region(reg_t addr)
 {
-  // Find the device with the base address closest to but
-  // less than addr (price-is-right search)
-  auto it = devices.upper_bound(addr);
-  if (devices.empty() || it == devices.begin()) {
-    // Either the bus is empty, or there weren't 
-    // any items with a base address <= addr
-    return false;
+  // Find the region with the base address closest to but
+  // not above addr (price-is-right search)
+  auto it = std::upper_bound(regions.begin(), regions.end(), addr,
+      [](reg_t a, const region_t& r) { return a < r.base; });
+  if (it == regions.begin()) {
+    // Either the bus is empty, or there weren't
+    // any regions with a base address <= addr
+    return NULL;
   }
-  // Found at least one item with base address <= addr
-  // The iterator points to the device after this, so
-  // go back by one item.
-  it--;
-  return it->second->load(addr - it->first, len, bytes);
+  return &*(it - 1);
+}
+
+char* bus_t::addr_to_mem(reg_t addr)
+{
+  const region_t* r = find_region(addr);
+  if (r && r->host && addr - r->base < r->host_size)
+    return r->host + (addr - r->base);
+  return NULL;
+}
+
+bool bus_t::load(reg_t addr, size_t len, uint8_t* bytes)
+{
+  const region_t* r = find_region(addr);
+  return r && r->dev->load(addr - r->base, len, bytes);
 }
 
 bool bus_t::store(reg_t addr, size_t len, const uint8_t* bytes)
 {
-  // See comments in bus_t::load
-  auto it = devices.upper_bound(addr);
-  if (devices.empty() || it == devices.begin()) {
-    return false;
-  }
-  it--;
-  return it->second->store(addr - it->first, len, bytes);
+  const region_t* r = find_region(addr);
+  return r && r->dev->store(addr - r->base, len, bytes);
 }
 
 std::pair<reg_t, abstract_device_t*> bus_t::find_device(reg_t addr)
 {
-  // See comments in bus_t::load
-  auto it = devices.upper_bound(addr);
-  if (devices.empty() || it == devices.begin()) {
+  const region_t* r = find_region(addr);
+  if (!r)
     return std::make_pair((reg_t)0, (abstract_device_t*)NULL);
+  return std::make_pair(r->base, r->dev);
+}
+
+static void read_file(int fd, off_t file_offset, char* dst, size_t n)
+{
+  while (n) {
+    ssize_t got = pread(fd, dst, n, file_offset);
+    if (got <= 0)
+      throw std::runtime_error("couldn't read file into target memory");
+    dst += got;
+    file_offset += got;
+    n -= got;
   }
-  it--;
-  return std::make_pair(it->first, it->second);
+}
+
+void mem_t::load_file(int fd, off_t file_offset, reg_t offset, size_t n)
+{
+  if (offset > len || n > len - offset)
+    throw std::runtime_error("file does not fit into target memory");
+
+  // copied rather than mapped from the file, so the memory does not change
+  // or fault if the file is rebuilt or truncated while the simulation runs
+  read_file(fd, file_offset, data + offset, n);
 }
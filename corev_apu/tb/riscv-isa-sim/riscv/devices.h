@@ -7,6 +7,9 @@
 #include <map>
 #include <vector>
 #include <fstream>
+#include <mutex>
+#include <sys/types.h>
+#include <sys/mman.h>
 
 class processor_t;
 
@@ -19,14 +22,28 @@ class abstract_device_t {
 
 class bus_t : public abstract_device_t {
  public:
+  // One entry of the flat region table: the device whose base address is
+  // the closest one at or below an address, with the host pointer of RAM
+  // resolved up front.
+  struct region_t {
+    reg_t base;
+    abstract_device_t* dev;
+    char* host; // NULL unless dev is a mem_t
+    reg_t host_size;
+  };
+
   bool load(reg_t addr, size_t len, uint8_t* bytes);
   bool store(reg_t addr, size_t len, const uint8_t* bytes);
   void add_device(reg_t addr, abstract_device_t* dev);
 
   std::pair<reg_t, abstract_device_t*> find_device(reg_t addr);
+  const region_t* find_region(reg_t addr);
+  char* addr_to_mem(reg_t addr);
 
  private:
   std::map<reg_t, abstract_device_t*> devices;
+  // sorted by base; rebuilt from devices whenever one is added
+  std::vector<region_t> regions;
 };
 
 class rom_device_t : public abstract_device_t {
@@ -44,12 +61,21 @@ class mem_t : public abstract_device_t {
   mem_t(size_t size) : len(size) {
     if (!size)
       throw std::runtime_error("zero bytes of target memory requested");
-    data = (char*)calloc(1, size);
-    if (!data)
+    // Reserve the whole range up front so contents() stays one contiguous
+    // block for addr_to_mem and the TLB, but let the host commit pages only
+    // once they are touched: anonymous pages read as zero, and without swap
+    // reservation a sparse multi-GiB memory costs no more than what is used.
+    data = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (data == MAP_FAILED)
       throw std::runtime_error("couldn't allocate " + std::to_string(size) + " bytes of target memory");
   }
   mem_t(const mem_t& that) = delete;
-  ~mem_t() { free(data); }
+  ~mem_t() { munmap(data, len); }
+
+  // copy n bytes at file_offset of fd to offset in the memory; only the
+  // pages written here are committed, the rest of the memory stays untouched
+  void load_file(int fd, off_t file_offset, reg_t offset, size_t n);
 
   bool load(reg_t addr, size_t len, uint8_t* bytes) { return false; }
   bool store(reg_t addr, size_t len, const uint8_t* bytes) { return false; }
@@ -69,6 +95,8 @@ class clint_t : public abstract_device_t {
   void reset();
   size_t size() { return CLINT_SIZE; }
   void increment(reg_t inc);
+  // increments until mtime reaches hart i's mtimecmp, 0 if it already has
+  reg_t ticks_to_mtimecmp(size_t i);
  private:
   typedef uint64_t mtime_t;
   typedef uint64_t mtimecmp_t;
@@ -76,6 +104,9 @@ class clint_t : public abstract_device_t {
   std::vector<processor_t*>& procs;
   mtime_t mtime;
   std::vector<mtimecmp_t> mtimecmp;
+  // harts running on their own threads may access the CLINT concurrently
+  std::mutex lock;
+  void update_mtip();
 };
 
 class uart_t : public abstract_device_t {
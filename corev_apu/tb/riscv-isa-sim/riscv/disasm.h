@@ -67,6 +67,7 @@ class disassembler_t
   void add_insn(disasm_insn_t* insn);
  private:
   static const int HASH_SIZE = 256;
+  int xlen;
   std::vector<const disasm_insn_t*> chain[HASH_SIZE+1];
   const disasm_insn_t* lookup(insn_t insn) const;
 };
@@ -38,6 +38,8 @@ class jtag_dtm_t
 
     jtag_state_t state() const { return _state; }
 
+    debug_module_t *debug_module() const { return dm; }
+
   private:
     debug_module_t *dm;
     bool _tck, _tms, _tdi, _tdo;
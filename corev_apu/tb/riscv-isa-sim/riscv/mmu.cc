@@ -3,9 +3,17 @@
 #include "mmu.h"
 #include "simif.h"
 #include "processor.h"
+#include <algorithm>
+#include <cinttypes>
+#include <stdexcept>
+#include <stdio.h>
 
 mmu_t::mmu_t(simif_t* sim, processor_t* proc)
- : sim(sim), proc(proc),
+ : sim(sim), proc(proc), parallel(false),
+  page_tlb(PAGE_TLB_SETS * PAGE_TLB_WAYS),
+  page_tlb_sets(PAGE_TLB_SETS), page_tlb_ways(PAGE_TLB_WAYS),
+  page_tlb_clock(0), page_tlb_hits(0), page_tlb_misses(0),
+  page_tlb_stats(false),
   check_triggers_fetch(false),
   check_triggers_load(false),
   check_triggers_store(false),
@@ -17,6 +25,27 @@ mmu_t::mmu_t(simif_t* sim, processor_t* proc)
 
 mmu_t::~mmu_t()
 {
+  if (page_tlb_stats && proc) {
+    uint64_t accesses = page_tlb_hits + page_tlb_misses;
+    fprintf(stderr, "Page TLB (core %u, %zu sets, %zu ways):\n",
+            proc->id, page_tlb_sets, page_tlb_ways);
+    fprintf(stderr, "  Hits:      %" PRIu64 "\n", page_tlb_hits);
+    fprintf(stderr, "  Misses:    %" PRIu64 "\n", page_tlb_misses);
+    if (accesses)
+      fprintf(stderr, "  Miss Rate: %.3f%%\n", 100.0 * page_tlb_misses / accesses);
+  }
+}
+
+void mmu_t::configure_page_tlb(size_t sets, size_t ways)
+{
+  if (sets == 0 || (sets & (sets - 1)) || ways == 0)
+    throw std::invalid_argument("page TLB sets must be a power of 2 and ways nonzero");
+
+  page_tlb_sets = sets;
+  page_tlb_ways = ways;
+  page_tlb.assign(sets * ways, page_tlb_entry_t());
+  page_tlb_stats = true;
+  flush_tlb();
 }
 
 void mmu_t::flush_icache()
@@ -30,10 +59,37 @@ void mmu_t::flush_tlb()
   memset(tlb_insn_tag, -1, sizeof(tlb_insn_tag));
   memset(tlb_load_tag, -1, sizeof(tlb_load_tag));
   memset(tlb_store_tag, -1, sizeof(tlb_store_tag));
+  for (auto& e : page_tlb)
+    e = {0, 0, -1, 0};
+  flush_pwc();
 
   flush_icache();
 }
 
+void mmu_t::flush_pwc()
+{
+  for (size_t i = 0; i < PWC_ENTRIES; i++)
+    pwc[i].level = -1;
+  pwc_pages.clear();
+}
+
+void mmu_t::pwc_insert(reg_t satp, int level, reg_t prefix, reg_t base, reg_t pte_paddr)
+{
+  *pwc_entry(prefix, level) = {satp, prefix, base, level};
+
+  // stores to this page must now take the slow path, so drop any
+  // direct-mapped store translations that already point at it
+  reg_t ppn = pte_paddr >> PGSHIFT;
+  if (!pwc_pages.insert(ppn).second)
+    return;
+  for (size_t i = 0; i < TLB_ENTRIES; i++) {
+    reg_t vpn = tlb_store_tag[i] & ~TLB_CHECK_TRIGGERS;
+    if (tlb_store_tag[i] != reg_t(-1) &&
+        ((tlb_data[i].target_offset + (vpn << PGSHIFT)) >> PGSHIFT) == ppn)
+      tlb_store_tag[i] = -1;
+  }
+}
+
 static void throw_access_exception(reg_t addr, access_type type)
 {
   switch (type) {
@@ -135,10 +191,14 @@ void mmu_t::store_slow_path(reg_t addr, reg_t len, const uint8_t* bytes)
   }
 
   if (auto host_addr = sim->addr_to_mem(paddr)) {
-    memcpy(host_addr, bytes, len);
-    if (tracer.interested_in_range(paddr, paddr + PGSIZE, STORE))
+    // traced before the bytes change, so a tracer can save what they were
+    bool traced = tracer.interested_in_range(paddr, paddr + PGSIZE, STORE);
+    if (traced)
       tracer.trace(paddr, len, STORE);
-    else
+    memcpy(host_addr, bytes, len);
+    if (unlikely(pwc_pages.count(paddr >> PGSHIFT)))
+      flush_pwc();
+    if (!traced)
       refill_tlb(addr, paddr, host_addr, STORE);
   } else if (!sim->mmio_store(paddr, len, bytes)) {
     throw trap_store_access_fault(addr);
@@ -164,7 +224,10 @@ tlb_entry_t mmu_t::refill_tlb(reg_t vaddr, reg_t paddr, char* host_addr, access_
 
   if (pmp_homogeneous(paddr & ~reg_t(PGSIZE - 1), PGSIZE)) {
     if (type == FETCH) tlb_insn_tag[idx] = expected_tag;
-    else if (type == STORE) tlb_store_tag[idx] = expected_tag;
+    else if (type == STORE) {
+      if (!pwc_pages.count(paddr >> PGSHIFT))
+        tlb_store_tag[idx] = expected_tag;
+    }
     else tlb_load_tag[idx] = expected_tag;
   }
 
@@ -173,11 +236,12 @@ tlb_entry_t mmu_t::refill_tlb(reg_t vaddr, reg_t paddr, char* host_addr, access_
   return entry;
 }
 
-reg_t mmu_t::pmp_ok(reg_t addr, access_type type, reg_t mode)
+void mmu_t::pmp_updated()
 {
-  if (!proc)
-    return true;
-
+  // address range [lo, last] matched by each active entry
+  std::vector<std::pair<reg_t, reg_t>> ranges(proc->state.n_pmp);
+  std::vector<bool> active(proc->state.n_pmp);
+  std::vector<reg_t> bounds(1, 0);
   reg_t base = 0;
   for (size_t i = 0; i < proc->state.n_pmp; i++) {
     reg_t tor = proc->state.pmpaddr[i] << PMP_SHIFT;
@@ -187,24 +251,64 @@ reg_t mmu_t::pmp_ok(reg_t addr, access_type type, reg_t mode)
       bool is_tor = (cfg & PMP_A) == PMP_TOR;
       bool is_na4 = (cfg & PMP_A) == PMP_NA4;
 
-      reg_t mask = (proc->state.pmpaddr[i] << 1) | (!is_na4);
-      mask = ~(mask & ~(mask + 1)) << PMP_SHIFT;
-      bool napot_match = ((addr ^ tor) & mask) == 0;
-      bool tor_match = base <= addr && addr < tor;
-
-      if (is_tor ? tor_match : napot_match) {
-        return
-          (mode == PRV_M && !(cfg & PMP_L)) ||
-          (type == LOAD && (cfg & PMP_R)) ||
-          (type == STORE && (cfg & PMP_W)) ||
-          (type == FETCH && (cfg & PMP_X));
+      if (is_tor) {
+        active[i] = base < tor;
+        ranges[i] = std::make_pair(base, tor - 1);
+      } else {
+        reg_t mask = (proc->state.pmpaddr[i] << 1) | (!is_na4);
+        mask = ~(mask & ~(mask + 1)) << PMP_SHIFT;
+        active[i] = true;
+        ranges[i] = std::make_pair(tor & mask, (tor & mask) | ~mask);
+      }
+
+      if (active[i]) {
+        bounds.push_back(ranges[i].first);
+        if (ranges[i].second != reg_t(-1))
+          bounds.push_back(ranges[i].second + 1);
       }
     }
 
     base = tor;
   }
+  std::sort(bounds.begin(), bounds.end());
+  bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+  // no entry changes between two bounds, so classify each by its start
+  pmp_regions.clear();
+  for (reg_t b : bounds) {
+    int entry = -1;
+    for (size_t i = 0; i < proc->state.n_pmp && entry < 0; i++)
+      if (active[i] && ranges[i].first <= b && b <= ranges[i].second)
+        entry = i;
+    if (!pmp_regions.empty() && pmp_regions.back().entry == entry)
+      continue;
+
+    uint8_t rwx = PMP_R | PMP_W | PMP_X;
+    uint8_t cfg = entry < 0 ? 0 : proc->state.pmpcfg[entry];
+    uint8_t perm_m = entry < 0 || !(cfg & PMP_L) ? rwx : cfg & rwx;
+    pmp_regions.push_back({b, entry, perm_m, uint8_t(cfg & rwx)});
+  }
 
-  return mode == PRV_M;
+  flush_tlb();
+}
+
+const mmu_t::pmp_region_t* mmu_t::pmp_region(reg_t addr)
+{
+  auto it = std::upper_bound(pmp_regions.begin(), pmp_regions.end(), addr,
+      [](reg_t a, const pmp_region_t& r) { return a < r.base; });
+  return &*(it - 1); // the first region always starts at 0
+}
+
+reg_t mmu_t::pmp_ok(reg_t addr, access_type type, reg_t mode)
+{
+  if (!proc)
+    return true;
+
+  const pmp_region_t* r = pmp_region(addr);
+  uint8_t perm = mode == PRV_M ? r->perm_m : r->perm_su;
+  return type == LOAD ? (perm & PMP_R) :
+         type == STORE ? (perm & PMP_W) :
+                         (perm & PMP_X);
 }
 
 reg_t mmu_t::pmp_homogeneous(reg_t addr, reg_t len)
@@ -215,35 +319,62 @@ reg_t mmu_t::pmp_homogeneous(reg_t addr, reg_t len)
   if (!proc)
     return true;
 
-  reg_t base = 0;
-  for (size_t i = 0; i < proc->state.n_pmp; i++) {
-    reg_t tor = proc->state.pmpaddr[i] << PMP_SHIFT;
-    uint8_t cfg = proc->state.pmpcfg[i];
-
-    if (cfg & PMP_A) {
-      bool is_tor = (cfg & PMP_A) == PMP_TOR;
-      bool is_na4 = (cfg & PMP_A) == PMP_NA4;
-
-      bool begins_after_lower = addr >= base;
-      bool begins_after_upper = addr >= tor;
-      bool ends_before_lower = (addr & -len) < (base & -len);
-      bool ends_before_upper = (addr & -len) < (tor & -len);
-      bool tor_homogeneous = ends_before_lower || begins_after_upper ||
-        (begins_after_lower && ends_before_upper);
+  const pmp_region_t* r = pmp_region(addr);
+  return r + 1 == pmp_regions.data() + pmp_regions.size() ||
+         addr + (len - 1) < r[1].base;
+}
 
-      reg_t mask = (proc->state.pmpaddr[i] << 1) | (!is_na4);
-      mask = ~(mask & ~(mask + 1)) << PMP_SHIFT;
-      bool mask_homogeneous = ~(mask << 1) & len;
-      bool napot_homogeneous = mask_homogeneous || ((addr ^ tor) / len) != 0;
+mmu_t::page_tlb_entry_t* mmu_t::page_tlb_lookup(reg_t vpn, int levels, int idxbits)
+{
+  for (int level = 0; level < levels; level++) {
+    reg_t tag = vpn >> (level * idxbits);
+    page_tlb_entry_t* set = &page_tlb[((tag + level) & (page_tlb_sets - 1)) * page_tlb_ways];
+    for (size_t way = 0; way < page_tlb_ways; way++) {
+      if (set[way].level == level && set[way].vpn == tag) {
+        set[way].stamp = ++page_tlb_clock;
+        return &set[way];
+      }
+    }
+  }
+  return NULL;
+}
 
-      if (!(is_tor ? tor_homogeneous : napot_homogeneous))
-        return false;
+void mmu_t::page_tlb_insert(reg_t vpn, int level, int idxbits, reg_t pte)
+{
+  reg_t tag = vpn >> (level * idxbits);
+  page_tlb_entry_t* set = &page_tlb[((tag + level) & (page_tlb_sets - 1)) * page_tlb_ways];
+
+  // a walk can supersede a cached copy (e.g. one without the D bit), so
+  // update that entry rather than caching the mapping twice
+  for (size_t way = 0; way < page_tlb_ways; way++) {
+    if (set[way].level == level && set[way].vpn == tag) {
+      set[way] = {tag, pte, level, ++page_tlb_clock};
+      return;
     }
+  }
 
-    base = tor;
+  page_tlb_entry_t* victim = &set[0];
+  for (size_t way = 0; way < page_tlb_ways; way++) {
+    if (set[way].level < 0) { // invalid entries have stamp 0
+      victim = &set[way];
+      break;
+    }
+    if (set[way].stamp < victim->stamp)
+      victim = &set[way];
   }
+  *victim = {tag, pte, level, ++page_tlb_clock};
+}
 
-  return true;
+// check the permission bits of a leaf PTE for an access of the given type
+static bool pte_permits(reg_t pte, access_type type, bool s_mode, bool sum, bool mxr)
+{
+  if ((pte & PTE_U) ? s_mode && (type == FETCH || !sum) : !s_mode)
+    return false;
+  if (!(pte & PTE_V) || (!(pte & PTE_R) && (pte & PTE_W)))
+    return false;
+  return type == FETCH ? (pte & PTE_X) :
+         type == LOAD ?  (pte & PTE_R) || (mxr && (pte & PTE_X)) :
+                         (pte & PTE_R) && (pte & PTE_W);
 }
 
 reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode)
@@ -263,8 +394,34 @@ reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode)
   if (masked_msbs != 0 && masked_msbs != mask)
     vm.levels = 0;
 
+  // a cached leaf needs no walk unless it would fault or needs A/D updates
+  reg_t vpn = addr >> PGSHIFT;
+  if (auto e = page_tlb_lookup(vpn, vm.levels, vm.idxbits)) {
+    reg_t ad = PTE_A | ((type == STORE) * PTE_D);
+    if (pte_permits(e->pte, type, s_mode, sum, mxr) && (e->pte & ad) == ad) {
+      page_tlb_hits++;
+      int ptshift = e->level * vm.idxbits;
+      reg_t ppn = e->pte >> PTE_PPN_SHIFT;
+      return (ppn | (vpn & ((reg_t(1) << ptshift) - 1))) << PGSHIFT;
+    }
+  }
+  page_tlb_misses++;
+
+  // resume from the deepest non-leaf PTE in the page-walk cache
+  reg_t satp = proc->get_state()->satp;
   reg_t base = vm.ptbase;
-  for (int i = vm.levels - 1; i >= 0; i--) {
+  int start = vm.levels - 1;
+  for (int i = 1; i < vm.levels; i++) {
+    reg_t prefix = addr >> (PGSHIFT + i * vm.idxbits);
+    pwc_entry_t* e = pwc_entry(prefix, i);
+    if (e->level == i && e->prefix == prefix && e->satp == satp) {
+      base = e->base;
+      start = i - 1;
+      break;
+    }
+  }
+
+  for (int i = start; i >= 0; i--) {
     int ptshift = i * vm.idxbits;
     reg_t idx = (addr >> (PGSHIFT + ptshift)) & ((1 << vm.idxbits) - 1);
 
@@ -279,13 +436,9 @@ reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode)
 
     if (PTE_TABLE(pte)) { // next level of page table
       base = ppn << PGSHIFT;
-    } else if ((pte & PTE_U) ? s_mode && (type == FETCH || !sum) : !s_mode) {
-      break;
-    } else if (!(pte & PTE_V) || (!(pte & PTE_R) && (pte & PTE_W))) {
-      break;
-    } else if (type == FETCH ? !(pte & PTE_X) :
-               type == LOAD ?  !(pte & PTE_R) && !(mxr && (pte & PTE_X)) :
-                               !((pte & PTE_R) && (pte & PTE_W))) {
+      if (i > 0)
+        pwc_insert(satp, i, addr >> (PGSHIFT + ptshift), base, pte_paddr);
+    } else if (!pte_permits(pte, type, s_mode, sum, mxr)) {
       break;
     } else if ((ppn & ((reg_t(1) << ptshift) - 1)) != 0) {
       break;
@@ -296,15 +449,19 @@ reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode)
       if ((pte & ad) != ad) {
         if (!pmp_ok(pte_paddr, STORE, PRV_S))
           throw_access_exception(addr, type);
+        if (tracer.interested_in_range(pte_paddr, pte_paddr + 4, STORE))
+          tracer.trace(pte_paddr, 4, STORE);
         *(uint32_t*)ppte |= ad;
+        pte |= ad;
       }
 #else
       // take exception if access or possibly dirty bit is not set.
       if ((pte & ad) != ad)
         break;
 #endif
+      page_tlb_insert(vpn, i, vm.idxbits, pte);
+
       // for superpage mappings, make a fake leaf PTE for the TLB's benefit.
-      reg_t vpn = addr >> PGSHIFT;
       reg_t value = (ppn | (vpn & ((reg_t(1) << ptshift) - 1))) << PGSHIFT;
       return value;
     }
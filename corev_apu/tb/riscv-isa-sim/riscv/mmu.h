@@ -12,6 +12,7 @@
 #include "memtracer.h"
 #include <stdlib.h>
 #include <vector>
+#include <set>
 
 // virtual memory configuration
 #define PGSHIFT 12
@@ -140,6 +141,14 @@ public:
         throw trap_store_address_misaligned(addr); \
       try { \
         auto lhs = load_##type(addr); \
+        if (unlikely(parallel)) { \
+          /* other harts may store concurrently, so retry until no one did */ \
+          if (auto host = (type##_t*)atomic_host_addr(addr, sizeof(type##_t))) { \
+            while (!__atomic_compare_exchange_n(host, &lhs, f(lhs), false, \
+                                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) ; \
+            return lhs; \
+          } \
+        } \
         store_##type(addr, f(lhs)); \
         return lhs; \
       } catch (trap_load_page_fault& t) { \
@@ -180,6 +189,41 @@ public:
   amo_func(uint32)
   amo_func(uint64)
 
+  // template for LR: load a value and reserve its address
+  #define load_reserved_func(type) \
+    type##_t load_reserved_##type(reg_t addr) { \
+      acquire_load_reservation(addr); \
+      type##_t res = load_##type(addr); \
+      load_reservation_value = res; \
+      return res; \
+    }
+
+  // template for SC: store if the reservation still holds; returns success.
+  // In parallel mode another hart's store cannot clear our reservation, so
+  // the store only succeeds if memory still holds the value LR observed.
+  #define store_conditional_func(type) \
+    bool store_conditional_##type(reg_t addr, type##_t val) { \
+      if (!check_load_reservation(addr)) \
+        return false; \
+      if (unlikely(parallel)) { \
+        if (auto host = (type##_t*)atomic_host_addr(addr, sizeof(type##_t))) { \
+          type##_t expected = load_reservation_value; \
+          return __atomic_compare_exchange_n(host, &expected, val, false, \
+                                             __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST); \
+        } \
+      } \
+      store_##type(addr, val); \
+      return true; \
+    }
+
+  load_reserved_func(int32)
+  load_reserved_func(int64)
+  store_conditional_func(uint32)
+  store_conditional_func(uint64)
+
+  // harts run on separate host threads: make AMOs and SC atomic on host memory
+  void set_parallel(bool value) { parallel = value; }
+
   inline void yield_load_reservation()
   {
     load_reservation_address = (reg_t)-1;
@@ -203,6 +247,27 @@ public:
       throw trap_store_access_fault(vaddr); // disallow SC to I/O space
   }
 
+  // host address for an atomic update of vaddr, or NULL if the access
+  // must take the regular store path (MMIO, tracing, triggers)
+  inline char* atomic_host_addr(reg_t vaddr, reg_t len)
+  {
+    reg_t vpn = vaddr >> PGSHIFT;
+    if (likely(tlb_store_tag[vpn % TLB_ENTRIES] == vpn))
+      return tlb_data[vpn % TLB_ENTRIES].host_offset + vaddr;
+    if (check_triggers_store)
+      return NULL;
+    reg_t paddr = translate(vaddr, len, STORE);
+    if (tracer.interested_in_range(paddr, paddr + PGSIZE, STORE))
+      return NULL;
+    if (auto host_addr = sim->addr_to_mem(paddr)) {
+      // as in store_slow_path: the update may rewrite a cached PTE
+      if (unlikely(pwc_pages.count(paddr >> PGSHIFT)))
+        flush_pwc();
+      return refill_tlb(vaddr, paddr, host_addr, STORE).host_offset + vaddr;
+    }
+    return NULL;
+  }
+
   static const reg_t ICACHE_ENTRIES = 1024;
 
   inline size_t icache_index(reg_t addr)
@@ -230,7 +295,8 @@ public:
       insn |= (insn_bits_t)*(const uint16_t*)translate_insn_addr_to_host(addr + 2) << 16;
     }
 
-    insn_fetch_t fetch = {proc->decode_insn(insn), insn};
+    insn_t decoded(insn, proc->get_xlen());
+    insn_fetch_t fetch = {proc->decode_insn(decoded), decoded};
     entry->tag = addr;
     entry->next = &icache[icache_index(addr + length)];
     entry->data = fetch;
@@ -260,8 +326,18 @@ public:
   void flush_tlb();
   void flush_icache();
 
+  // resize the page TLB; sets must be a power of 2.  Once configured, the
+  // hit/miss counts are reported when the MMU is destroyed.
+  void configure_page_tlb(size_t sets, size_t ways);
+  uint64_t get_page_tlb_hits() { return page_tlb_hits; }
+  uint64_t get_page_tlb_misses() { return page_tlb_misses; }
+
   void register_memtracer(memtracer_t*);
 
+  // rebuild the PMP decision table from the pmpcfg/pmpaddr state; must be
+  // called whenever those change
+  void pmp_updated();
+
   int is_dirty_enabled()
   {
 #ifdef RISCV_ENABLE_DIRTY
@@ -285,6 +361,8 @@ private:
   processor_t* proc;
   memtracer_list_t tracer;
   reg_t load_reservation_address;
+  reg_t load_reservation_value;
+  bool parallel;
   uint16_t fetch_temp;
 
   // implement an instruction cache for simulator performance
@@ -300,6 +378,46 @@ private:
   reg_t tlb_load_tag[TLB_ENTRIES];
   reg_t tlb_store_tag[TLB_ENTRIES];
 
+  // Set-associative cache of leaf PTEs behind the direct-mapped TLB above.
+  // Entries are kept at the size of the mapping, so one entry covers a whole
+  // 2 MiB/1 GiB superpage; a hit lets translate() skip the page-table walk.
+  struct page_tlb_entry_t {
+    reg_t vpn; // VPN with the page-offset bits of a superpage removed
+    reg_t pte;
+    int level; // -1 if invalid
+    uint64_t stamp; // last use, for LRU replacement
+  };
+  static const size_t PAGE_TLB_SETS = 256;
+  static const size_t PAGE_TLB_WAYS = 4;
+  std::vector<page_tlb_entry_t> page_tlb;
+  size_t page_tlb_sets;
+  size_t page_tlb_ways;
+  uint64_t page_tlb_clock;
+  uint64_t page_tlb_hits;
+  uint64_t page_tlb_misses;
+  bool page_tlb_stats;
+  page_tlb_entry_t* page_tlb_lookup(reg_t vpn, int levels, int idxbits);
+  void page_tlb_insert(reg_t vpn, int level, int idxbits, reg_t pte);
+
+  // Page-walk cache: non-leaf PTEs keyed by (satp, level, VPN prefix), so a
+  // walk can resume at the deepest cached level.  Stores to a page holding
+  // a cached PTE go through store_slow_path, which drops the whole cache.
+  struct pwc_entry_t {
+    reg_t satp;
+    reg_t prefix; // VPN bits above this level
+    reg_t base; // physical address of the next-level table
+    int level; // -1 if invalid
+  };
+  static const size_t PWC_ENTRIES = 256;
+  pwc_entry_t pwc[PWC_ENTRIES];
+  std::set<reg_t> pwc_pages; // physical pages holding cached PTEs
+  inline pwc_entry_t* pwc_entry(reg_t prefix, int level)
+  {
+    return &pwc[(prefix * 4 + level) % PWC_ENTRIES];
+  }
+  void pwc_insert(reg_t satp, int level, reg_t prefix, reg_t base, reg_t pte_paddr);
+  void flush_pwc();
+
   // finish translation on a TLB miss and update the TLB
   tlb_entry_t refill_tlb(reg_t vaddr, reg_t paddr, char* host_addr, access_type type);
   const char* fill_from_mmio(reg_t vaddr, reg_t paddr);
@@ -353,6 +471,17 @@ private:
     return new trigger_matched_t(match, operation, address, data);
   }
 
+  // PMP decision table: maximal address ranges [base, next base) decided by
+  // the same PMP entry, with the resulting R/W/X permissions per privilege.
+  struct pmp_region_t {
+    reg_t base;
+    int entry; // lowest-numbered matching entry, or -1
+    uint8_t perm_m;
+    uint8_t perm_su;
+  };
+  std::vector<pmp_region_t> pmp_regions;
+  const pmp_region_t* pmp_region(reg_t addr);
+
   reg_t pmp_homogeneous(reg_t addr, reg_t len);
   reg_t pmp_ok(reg_t addr, access_type type, reg_t mode);
 
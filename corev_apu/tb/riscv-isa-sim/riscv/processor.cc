@@ -155,6 +155,7 @@ void processor_t::set_histogram(bool value)
 void processor_t::reset()
 {
   state.reset(max_isa);
+  mmu->pmp_updated();
   state.dcsr.halt = halt_on_reset;
   halt_on_reset = false;
   set_csr(CSR_MSTATUS, state.mstatus);
@@ -166,6 +167,26 @@ void processor_t::reset()
     sim->proc_reset(id);
 }
 
+void processor_t::save_snapshot(snapshot_t& s)
+{
+  s.state = state;
+  s.xlen = xlen;
+  s.load_reservation_address = mmu->load_reservation_address;
+  s.load_reservation_value = mmu->load_reservation_value;
+}
+
+void processor_t::restore_snapshot(const snapshot_t& s)
+{
+  state = s.state;
+  xlen = s.xlen;
+  mmu->load_reservation_address = s.load_reservation_address;
+  mmu->load_reservation_value = s.load_reservation_value;
+  mmu->pmp_updated();
+  trigger_updated();
+  // memory may have been restored underneath the TLB and the icache too
+  mmu->flush_tlb();
+}
+
 // Count number of contiguous 0 bits starting from the LSB.
 static int ctz(reg_t val)
 {
@@ -346,7 +367,7 @@ void processor_t::set_csr(int which, reg_t val)
   //   if (!locked && !(next_locked && next_tor))
   //     state.pmpaddr[i] = val;
 
-  //   // mmu->flush_tlb();
+  //   mmu->pmp_updated();
   // }
 
   // if (which >= CSR_PMPCFG0 && which < CSR_PMPCFG0 + state.n_pmp / 4) {
@@ -354,7 +375,7 @@ void processor_t::set_csr(int which, reg_t val)
   //     if (!(state.pmpcfg[i] & PMP_L))
   //       state.pmpcfg[i] = (val >> (8 * (i - i0))) & (PMP_R | PMP_W | PMP_X | PMP_A | PMP_L);
   //   }
-  //   // mmu->flush_tlb();
+  //   mmu->pmp_updated();
   // }
 
   switch (which)
@@ -407,7 +428,7 @@ void processor_t::set_csr(int which, reg_t val)
     }
     case CSR_MIP: {
       reg_t mask = MIP_SSIP | MIP_STIP;
-      state.mip = (state.mip & ~mask) | (val & mask);
+      state.set_mip(mask, val);
       break;
     }
     case CSR_MIE:
@@ -457,7 +478,7 @@ void processor_t::set_csr(int which, reg_t val)
     }
     case CSR_SIP: {
       reg_t mask = MIP_SSIP & state.mideleg;
-      return set_csr(CSR_MIP, (state.mip & ~mask) | (val & mask));
+      return set_csr(CSR_MIP, (state.get_mip() & ~mask) | (val & mask));
     }
     case CSR_SIE:
       return set_csr(CSR_MIE,
@@ -642,7 +663,7 @@ reg_t processor_t::get_csr(int which)
         sstatus |= (xlen == 32 ? SSTATUS32_SD : SSTATUS64_SD);
       return sstatus;
     }
-    case CSR_SIP: return state.mip & state.mideleg;
+    case CSR_SIP: return state.get_mip() & state.mideleg;
     case CSR_SIE: return state.mie & state.mideleg;
     case CSR_SEPC: return state.sepc & pc_alignment_mask();
     case CSR_STVAL: return state.stval;
@@ -657,7 +678,7 @@ reg_t processor_t::get_csr(int which)
       return state.satp;
     case CSR_SSCRATCH: return state.sscratch;
     case CSR_MSTATUS: return state.mstatus;
-    case CSR_MIP: return state.mip;
+    case CSR_MIP: return state.get_mip();
     case CSR_MIE: return state.mie;
     case CSR_MEPC: return state.mepc & pc_alignment_mask();
     case CSR_MSCRATCH: return state.mscratch;
@@ -734,31 +755,16 @@ reg_t illegal_instruction(processor_t* p, insn_t insn, reg_t pc)
 
 insn_func_t processor_t::decode_insn(insn_t insn)
 {
-  // look up opcode in hash table
-  size_t idx = insn.bits() % OPCODE_CACHE_SIZE;
-  insn_desc_t desc = opcode_cache[idx];
-
-  if (unlikely(insn.bits() != desc.match)) {
-    // fall back to linear search
-    insn_desc_t* p = &instructions[0];
-    while ((insn.bits() & p->mask) != p->match)
-      p++;
-    desc = *p;
-
-    if (p->mask != 0 && p > &instructions[0]) {
-      if (p->match != (p-1)->match && p->match != (p+1)->match) {
-        // move to front of opcode list to reduce miss penalty
-        while (--p >= &instructions[0])
-          *(p+1) = *p;
-        instructions[0] = desc;
-      }
-    }
+  insn_bits_t bits = insn.bits();
+  const decode_bucket_t& bucket = decode_table[decode_index(bits)];
+  const insn_desc_t* p = bucket.by_funct7.empty() ? &bucket.insns[0]
+                         : &bucket.by_funct7[(bits >> 25) & 0x7f][0];
 
-    opcode_cache[idx] = desc;
-    opcode_cache[idx].match = insn.bits();
-  }
+  // the list ends with the catch-all, so this always terminates
+  while ((bits & p->mask) != p->match)
+    p++;
 
-  return xlen == 64 ? desc.rv64 : desc.rv32;
+  return xlen == 64 ? p->rv64 : p->rv32;
 }
 
 void processor_t::register_insn(insn_desc_t desc)
@@ -777,8 +783,42 @@ void processor_t::build_opcode_map()
   };
   std::sort(instructions.begin(), instructions.end(), cmp());
 
-  for (size_t i = 0; i < OPCODE_CACHE_SIZE; i++)
-    opcode_cache[i] = {0, 0, &illegal_instruction, &illegal_instruction};
+  // an instruction lands in every bucket whose index bits it may match
+  auto may_match = [](const insn_desc_t& d, insn_bits_t bits, insn_bits_t field) {
+    return ((bits ^ d.match) & d.mask & field) == 0;
+  };
+
+  for (size_t i = 0; i < DECODE_TABLE_SIZE; i++) {
+    decode_bucket_t& bucket = decode_table[i];
+    bucket.insns.clear();
+    bucket.by_funct7.clear();
+
+    insn_bits_t bits, field;
+    if (i < DECODE_RVC_BASE) {
+      if ((i & 0x3) != 0x3)
+        continue;
+      bits = (i & 0x7f) | ((i & 0x380) << 5);
+      field = 0x707f;
+    } else {
+      if (((i - DECODE_RVC_BASE) & 0x3) == 0x3)
+        continue;
+      bits = ((i - DECODE_RVC_BASE) & 0x3) | (((i - DECODE_RVC_BASE) & 0x1c) << 11);
+      field = 0xe003;
+    }
+
+    for (auto& d : instructions)
+      if (may_match(d, bits, field))
+        bucket.insns.push_back(d);
+
+    if (i >= DECODE_RVC_BASE || bucket.insns.size() <= DECODE_SPLIT_THRESHOLD)
+      continue;
+
+    bucket.by_funct7.resize(128);
+    for (insn_bits_t funct7 = 0; funct7 < 128; funct7++)
+      for (auto& d : bucket.insns)
+        if (may_match(d, funct7 << 25, insn_bits_t(0x7f) << 25))
+          bucket.by_funct7[funct7].push_back(d);
+  }
 }
 
 void processor_t::register_extension(extension_t* x)
@@ -817,7 +857,7 @@ bool processor_t::load(reg_t addr, size_t len, uint8_t* bytes)
     case 0:
       if (len <= 4) {
         memset(bytes, 0, len);
-        bytes[0] = get_field(state.mip, MIP_MSIP);
+        bytes[0] = get_field(state.get_mip(), MIP_MSIP);
         return true;
       }
       break;
@@ -832,7 +872,7 @@ bool processor_t::store(reg_t addr, size_t len, const uint8_t* bytes)
   {
     case 0:
       if (len <= 4) {
-        state.mip = set_field(state.mip, MIP_MSIP, bytes[0]);
+        state.set_mip(MIP_MSIP, set_field(0, MIP_MSIP, bytes[0]));
         return true;
       }
       break;
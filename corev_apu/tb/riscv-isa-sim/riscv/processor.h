@@ -88,6 +88,17 @@ struct state_t
 {
   void reset(reg_t max_isa);
 
+  // The CLINT updates MSIP/MTIP from whichever thread stores to it, which
+  // with parallel harts is not the thread running this hart, so mip is
+  // only read and written through these.
+  reg_t get_mip() const { return __atomic_load_n(&mip, __ATOMIC_ACQUIRE); }
+  void set_mip(reg_t mask, reg_t val)
+  {
+    reg_t old = get_mip();
+    while (!__atomic_compare_exchange_n(&mip, &old, (old & ~mask) | (val & mask),
+                                        true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) ;
+  }
+
   static const int num_triggers = 4;
 
   reg_t pc;
@@ -173,6 +184,18 @@ public:
   void set_debug(bool value);
   void set_histogram(bool value);
   void reset();
+
+  // Everything a hart's execution depends on apart from memory and devices,
+  // so instructions can be rolled back by restoring it
+  struct snapshot_t
+  {
+    state_t state;
+    unsigned xlen;
+    reg_t load_reservation_address;
+    reg_t load_reservation_value;
+  };
+  void save_snapshot(snapshot_t& s);
+  void restore_snapshot(const snapshot_t& s); // flushes the MMU's caches
   void step(size_t n); // run for n cycles
   void set_csr(int which, reg_t val);
   reg_t get_csr(int which);
@@ -316,10 +339,28 @@ private:
   std::vector<insn_desc_t> instructions;
   std::map<reg_t,uint64_t> pc_histogram;
 
-  static const size_t OPCODE_CACHE_SIZE = 8191;
-  insn_desc_t opcode_cache[OPCODE_CACHE_SIZE];
+  // Two-level decode table built by build_opcode_map().  The first level
+  // is indexed by major opcode and funct3 (quadrant and funct3 for RVC);
+  // crowded buckets are split again by funct7.  Each list holds the
+  // candidate instructions in the priority order of `instructions' and
+  // ends with the illegal-instruction catch-all.
+  struct decode_bucket_t
+  {
+    std::vector<insn_desc_t> insns;
+    std::vector<std::vector<insn_desc_t>> by_funct7;
+  };
+  static const size_t DECODE_RVC_BASE = 1024;
+  static const size_t DECODE_TABLE_SIZE = DECODE_RVC_BASE + 32;
+  static const size_t DECODE_SPLIT_THRESHOLD = 8;
+  decode_bucket_t decode_table[DECODE_TABLE_SIZE];
+  static size_t decode_index(insn_bits_t bits)
+  {
+    if ((bits & 0x3) == 0x3)
+      return (bits & 0x7f) | ((bits >> 5) & 0x380);
+    return DECODE_RVC_BASE + ((bits & 0x3) | ((bits >> 11) & 0x1c));
+  }
 
-  void take_pending_interrupt() { take_interrupt(state.mip & state.mie); }
+  void take_pending_interrupt() { take_interrupt(state.get_mip() & state.mie); }
   void take_interrupt(reg_t mask); // take first enabled interrupt in mask
   void take_trap(trap_t& t, reg_t epc); // take an exception
   void disasm(insn_t insn); // disassemble and print an instruction
@@ -1,6 +1,7 @@
 #include <arpa/inet.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -10,6 +11,7 @@
 #include <cstdio>
 
 #include "remote_bitbang.h"
+#include "debug_module.h"
 
 #if 1
 #  define D(x) x
@@ -97,6 +99,109 @@ void remote_bitbang_t::tick()
   }
 }
 
+static void wait_for(int fd, short events)
+{
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = events;
+  while (poll(&pfd, 1, -1) == -1) {
+    if (errno != EINTR) {
+      fprintf(stderr, "remote_bitbang failed to poll socket: %s (%d)\n",
+          strerror(errno), errno);
+      abort();
+    }
+  }
+}
+
+void remote_bitbang_t::send_all(const void *buf, size_t len)
+{
+  const char *p = (const char *) buf;
+  size_t sent = 0;
+  while (sent < len) {
+    ssize_t bytes = write(client_fd, p + sent, len - sent);
+    if (bytes == -1) {
+      if (errno == EAGAIN) {
+        wait_for(client_fd, POLLOUT);
+        continue;
+      }
+      fprintf(stderr, "failed to write to socket: %s (%d)\n", strerror(errno), errno);
+      abort();
+    }
+    sent += bytes;
+  }
+}
+
+bool remote_bitbang_t::recv_all(void *buf, size_t len)
+{
+  char *p = (char *) buf;
+  size_t n = std::min<size_t>(len, recv_end - recv_start);
+  memcpy(p, recv_buf + recv_start, n);
+  recv_start += n;
+  while (n < len) {
+    ssize_t bytes = read(client_fd, p + n, len - n);
+    if (bytes == -1) {
+      if (errno == EAGAIN) {
+        wait_for(client_fd, POLLIN);
+        continue;
+      }
+      fprintf(stderr, "remote_bitbang failed to read on socket: %s (%d)\n",
+          strerror(errno), errno);
+      abort();
+    }
+    if (bytes == 0) {
+      fprintf(stderr, "Remote end disconnected during a block transfer.\n");
+      close(client_fd);
+      client_fd = 0;
+      return false;
+    }
+    n += bytes;
+  }
+  return true;
+}
+
+void remote_bitbang_t::block_transfer(uint8_t command)
+{
+  static uint8_t block_buf[buf_size];
+  debug_module_t *dm = tap->debug_module();
+
+  uint8_t header[4];
+  if (!recv_all(header, sizeof(header)))
+    return;
+  uint32_t len = header[0] | header[1] << 8 | header[2] << 16 |
+    (uint32_t) header[3] << 24;
+
+  // Once a chunk comes up short the bus reported an error, the rest of the
+  // transfer is still consumed (or padded) to keep the stream in sync.
+  uint32_t count = 0;
+  bool ok = true;
+  for (uint32_t offset = 0; offset < len; ) {
+    size_t chunk = std::min<size_t>(len - offset, buf_size);
+    if (command == 'W') {
+      if (!recv_all(block_buf, chunk))
+        return;
+      if (ok) {
+        size_t done = dm->sb_write_block(block_buf, chunk);
+        count += done;
+        ok = done == chunk;
+      }
+    } else {
+      size_t done = 0;
+      if (ok) {
+        done = dm->sb_read_block(block_buf, chunk);
+        count += done;
+        ok = done == chunk;
+      }
+      memset(block_buf + done, 0, chunk - done);
+      send_all(block_buf, chunk);
+    }
+    offset += chunk;
+  }
+
+  uint8_t reply[4] = {(uint8_t) count, (uint8_t) (count >> 8),
+    (uint8_t) (count >> 16), (uint8_t) (count >> 24)};
+  send_all(reply, sizeof(reply));
+}
+
 void remote_bitbang_t::execute_commands()
 {
   static char send_buf[buf_size];
@@ -108,7 +213,7 @@ void remote_bitbang_t::execute_commands()
     if (recv_start < recv_end) {
       unsigned send_offset = 0;
       while (recv_start < recv_end) {
-        uint8_t command = recv_buf[recv_start];
+        uint8_t command = recv_buf[recv_start++];
 
         switch (command) {
           case 'B': /* fprintf(stderr, "*BLINK*\n"); */ break;
@@ -124,11 +229,18 @@ void remote_bitbang_t::execute_commands()
           case '7': tap->set_pins(1, 1, 1); break;
           case 'R': send_buf[send_offset++] = tap->tdo() ? '1' : '0'; break;
           case 'Q': quit = true; break;
+          case 'W':
+          case 'G':
+            send_all(send_buf, send_offset);
+            send_offset = 0;
+            block_transfer(command);
+            if (client_fd == 0)
+              quit = true;
+            break;
           default:
                     fprintf(stderr, "remote_bitbang got unsupported command '%c'\n",
                         command);
         }
-        recv_start++;
         total_processed++;
         if (!in_rti && tap->state() == RUN_TEST_IDLE) {
           entered_rti = true;
@@ -136,15 +248,7 @@ void remote_bitbang_t::execute_commands()
         }
         in_rti = false;
       }
-      unsigned sent = 0;
-      while (sent < send_offset) {
-        ssize_t bytes = write(client_fd, send_buf + sent, send_offset);
-        if (bytes == -1) {
-          fprintf(stderr, "failed to write to socket: %s (%d)\n", strerror(errno), errno);
-          abort();
-        }
-        sent += bytes;
-      }
+      send_all(send_buf, send_offset);
     }
 
     if (total_processed > buf_size || quit || entered_rti) {
@@ -2,6 +2,7 @@
 #define REMOTE_BITBANG_H
 
 #include <stdint.h>
+#include <sys/types.h>
 
 #include "jtag_dtm.h"
 
@@ -10,6 +11,17 @@ class remote_bitbang_t
 public:
   // Create a new server, listening for connections from localhost on the given
   // port.
+  //
+  // Besides the usual bitbang commands the server takes two block transfer
+  // commands that go straight to System Bus Access of the debug module, for
+  // loading and dumping memory without shifting every word through JTAG.
+  // The debugger configures sbcs and sbaddress through the DMI as usual.
+  // Lengths are 32-bit little-endian byte counts.
+  //   'W' <len> <len bytes>  writes the bytes as if each word was written to
+  //                          sbdata0, replies with <count> of bytes written
+  //   'G' <len>              reads as if sbdata0 was read len / size times,
+  //                          replies with <len bytes> and <count> of them
+  //                          that are valid
   remote_bitbang_t(uint16_t port, jtag_dtm_t *tap);
 
   // Do a bit of work.
@@ -29,6 +41,12 @@ private:
   void accept();
   // Execute any commands the client has for us.
   void execute_commands();
+  // Run a 'W' or 'G' block transfer.
+  void block_transfer(uint8_t command);
+  // Blocking helpers for the block transfers, recv_all takes buffered bytes
+  // first and returns false if the client went away.
+  bool recv_all(void *buf, size_t len);
+  void send_all(const void *buf, size_t len);
 };
 
 #endif
@@ -32,6 +32,7 @@ sim_t::sim_t(const char* isa, size_t nprocs, bool halted, reg_t start_pc,
   : htif_t(args), mems(mems), procs(std::max(nprocs, size_t(1))),
     start_pc(start_pc), current_step(0), current_proc(0), debug(false),
     histogram_enabled(false), dtb_enabled(true), remote_bitbang(NULL),
+    parallel(false), quantum(0), harts_running(0), harts_exiting(false),
     debug_module(this, progsize, max_bus_master_bits, require_authentication)
 {
   signal(SIGINT, &handle_signal);
@@ -70,6 +71,14 @@ sim_t::sim_t(const char* isa, size_t nprocs, bool halted, reg_t start_pc,
 
 sim_t::~sim_t()
 {
+  {
+    std::lock_guard<std::mutex> lock(quantum_lock);
+    harts_exiting = true;
+  }
+  quantum_start.notify_all();
+  for (auto& t : hart_threads)
+    t.join();
+
   for (size_t i = 0; i < procs.size(); i++)
     delete procs[i];
   delete debug_mmu;
@@ -89,6 +98,8 @@ void sim_t::main()
   {
     if (debug || ctrlc_pressed)
       interactive();
+    else if (parallel)
+      step_parallel();
     else
       step(INTERLEAVE);
     if (remote_bitbang) {
@@ -126,6 +137,58 @@ void sim_t::step(size_t n)
   }
 }
 
+void sim_t::step_parallel()
+{
+  for (size_t i = hart_threads.size() + 1; i < procs.size(); i++)
+    hart_threads.emplace_back(&sim_t::hart_thread_main, this, i);
+
+  {
+    std::lock_guard<std::mutex> lock(quantum_lock);
+    harts_running = procs.size() - 1;
+    quantum++;
+  }
+  quantum_start.notify_all();
+
+  procs[0]->step(INTERLEAVE);
+
+  {
+    std::unique_lock<std::mutex> lock(quantum_lock);
+    quantum_done.wait(lock, [&] { return harts_running == 0; });
+  }
+
+  // every hart is parked here, so devices and the host see a quiet machine
+  clint->increment(INTERLEAVE / INSNS_PER_RTC_TICK);
+  host->switch_to();
+}
+
+void sim_t::hart_thread_main(size_t id)
+{
+  uint64_t seen = 0;
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(quantum_lock);
+      quantum_start.wait(lock, [&] { return harts_exiting || quantum != seen; });
+      if (harts_exiting)
+        return;
+      seen = quantum;
+    }
+
+    procs[id]->step(INTERLEAVE);
+
+    std::lock_guard<std::mutex> lock(quantum_lock);
+    if (--harts_running == 0)
+      quantum_done.notify_one();
+  }
+}
+
+void sim_t::set_parallel(bool value)
+{
+  parallel = value;
+  for (size_t i = 0; i < procs.size(); i++)
+    procs[i]->get_mmu()->set_parallel(value);
+}
+
 void sim_t::set_debug(bool value)
 {
   debug = value;
@@ -154,6 +217,9 @@ bool sim_t::mmio_load(reg_t addr, size_t len, uint8_t* bytes)
 {
   if (addr + len < addr)
     return false;
+  std::unique_lock<std::mutex> lock(mmio_lock, std::defer_lock);
+  if (parallel)
+    lock.lock();
   return bus.load(addr, len, bytes);
 }
 
@@ -161,6 +227,9 @@ bool sim_t::mmio_store(reg_t addr, size_t len, const uint8_t* bytes)
 {
   if (addr + len < addr)
     return false;
+  std::unique_lock<std::mutex> lock(mmio_lock, std::defer_lock);
+  if (parallel)
+    lock.lock();
   return bus.store(addr, len, bytes);
 }
 
@@ -185,11 +254,7 @@ void sim_t::make_dtb()
 }
 
 char* sim_t::addr_to_mem(reg_t addr) {
-  auto desc = bus.find_device(addr);
-  if (auto mem = dynamic_cast<mem_t*>(desc.second))
-    if (addr - desc.first < mem->size())
-      return mem->contents() + (addr - desc.first);
-  return NULL;
+  return bus.addr_to_mem(addr);
 }
 
 // htif
@@ -12,6 +12,9 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 class mmu_t;
 class remote_bitbang_t;
@@ -32,6 +35,8 @@ public:
   void set_log(bool value);
   void set_histogram(bool value);
   void set_procs_debug(bool value);
+  // run each hart on its own host thread; not deterministic
+  void set_parallel(bool value);
   void set_dtb_enabled(bool value) {
     this->dtb_enabled = value;
   }
@@ -59,6 +64,8 @@ private:
 
   processor_t* get_core(const std::string& i);
   void step(size_t n); // step through simulation
+  void step_parallel(); // run one quantum on all harts at once
+  void hart_thread_main(size_t id);
   static const size_t INTERLEAVE = 5000;
   static const size_t INSNS_PER_RTC_TICK = 100; // 10 MHz clock for 1 BIPS core
   static const size_t CPU_HZ = 1000000000; // 1GHz CPU
@@ -70,6 +77,18 @@ private:
   bool dtb_enabled;
   remote_bitbang_t* remote_bitbang;
 
+  // parallel mode: harts 1..n-1 run on hart_threads, hart 0 on the target
+  // context; all of them meet at the end of every INTERLEAVE quantum
+  bool parallel;
+  std::vector<std::thread> hart_threads;
+  std::mutex quantum_lock;
+  std::condition_variable quantum_start;
+  std::condition_variable quantum_done;
+  uint64_t quantum;
+  size_t harts_running;
+  bool harts_exiting;
+  std::mutex mmio_lock;
+
   // memory-mapped I/O routines
   char* addr_to_mem(reg_t addr);
   bool mmio_load(reg_t addr, size_t len, uint8_t* bytes);
@@ -268,11 +268,14 @@ struct : public arg_t {
 
 std::string disassembler_t::disassemble(insn_t insn) const
 {
+  // immediates are decoded per format, so re-decode for this XLEN
+  insn = insn_t(insn.bits(), xlen);
   const disasm_insn_t* disasm_insn = lookup(insn);
   return disasm_insn ? disasm_insn->to_string(insn) : "unknown";
 }
 
 disassembler_t::disassembler_t(int xlen)
+  : xlen(xlen)
 {
   const uint32_t mask_rd = 0x1fUL << 7;
   const uint32_t match_rd_ra = 1UL << 7;
@@ -52,7 +52,7 @@ int main(int argc, char** argv)
       if (nbits < 64)
         bits = bits << (64 - nbits) >> (64 - nbits);
 
-      string dis = p.get_disassembler()->disassemble(bits);
+      string dis = p.get_disassembler()->disassemble(insn_t(bits, p.get_max_xlen()));
       s = s.substr(0, start) + dis + s.substr(endp - &s[0] + 1);
       pos = start + dis.length();
     }
@@ -25,6 +25,8 @@ static void help()
   fprintf(stderr, "  -g                    Track histogram of PCs\n");
   fprintf(stderr, "  -l                    Generate a log of execution\n");
   fprintf(stderr, "  -h                    Print this help message\n");
+  fprintf(stderr, "  --parallel            Run each hart on its own host thread; faster on\n");
+  fprintf(stderr, "                          multicore hosts but not deterministic\n");
   fprintf(stderr, "  -H                    Start halted, allowing a debugger to connect\n");
   fprintf(stderr, "  --isa=<name>          RISC-V ISA string [default %s]\n", DEFAULT_ISA);
   fprintf(stderr, "  --pc=<address>        Override ELF entry point\n");
@@ -33,6 +35,8 @@ static void help()
   fprintf(stderr, "  --dc=<S>:<W>:<B>        W ways, and B-byte blocks (with S and\n");
   fprintf(stderr, "  --l2=<S>:<W>:<B>        B both powers of 2).\n");
   fprintf(stderr, "  --log-cache-miss      Generate a log of cache miss\n");
+  fprintf(stderr, "  --tlb=<S>:<W>         Size the simulator's page TLB with S sets and\n");
+  fprintf(stderr, "                          W ways (S a power of 2) and report its hit rate\n");
   fprintf(stderr, "  --extension=<name>    Specify RoCC Extension\n");
   fprintf(stderr, "  --extlib=<name>       Shared library to load\n");
   fprintf(stderr, "  --rbb-port=<port>     Listen on <port> for remote bitbang connection\n");
@@ -99,6 +103,18 @@ int main(int argc, char** argv)
   unsigned max_bus_master_bits = 0;
   bool require_authentication = false;
   std::vector<int> hartids;
+  size_t tlb_sets = 0, tlb_ways = 0;
+  bool parallel = false;
+
+  auto const tlb_parser = [&](const char *s) {
+    char* p;
+    tlb_sets = strtoull(s, &p, 0);
+    if (*p++ != ':')
+      help();
+    tlb_ways = strtoull(p, &p, 0);
+    if (*p || !tlb_sets || (tlb_sets & (tlb_sets - 1)) || !tlb_ways)
+      help();
+  };
 
   auto const hartids_parser = [&](const char *s) {
     std::string const str(s);
@@ -122,6 +138,7 @@ int main(int argc, char** argv)
   parser.option('m', 0, 1, [&](const char* s){mems = make_mems(s);});
   // I wanted to use --halted, but for some reason that doesn't work.
   parser.option('H', 0, 0, [&](const char* s){halted = true;});
+  parser.option(0, "parallel", 0, [&](const char* s){parallel = true;});
   parser.option(0, "rbb-port", 1, [&](const char* s){use_rbb = true; rbb_port = atoi(s);});
   parser.option(0, "pc", 1, [&](const char* s){start_pc = strtoull(s, 0, 0);});
   parser.option(0, "hartids", 1, hartids_parser);
@@ -129,6 +146,7 @@ int main(int argc, char** argv)
   parser.option(0, "dc", 1, [&](const char* s){dc.reset(new dcache_sim_t(s));});
   parser.option(0, "l2", 1, [&](const char* s){l2.reset(cache_sim_t::construct(s, "L2$"));});
   parser.option(0, "log-cache-miss", 0, [&](const char* s){log_cache = true;});
+  parser.option(0, "tlb", 1, tlb_parser);
   parser.option(0, "isa", 1, [&](const char* s){isa = s;});
   parser.option(0, "extension", 1, [&](const char* s){extension = find_extension(s);});
   parser.option(0, "dump-dts", 0, [&](const char *s){dump_dts = true;});
@@ -169,6 +187,12 @@ int main(int argc, char** argv)
     return 0;
   }
 
+  // the cache models are shared between harts and not thread-safe
+  if (parallel && (ic || dc)) {
+    fprintf(stderr, "--parallel cannot be combined with --ic or --dc\n");
+    return 1;
+  }
+
   if (ic && l2) ic->set_miss_handler(&*l2);
   if (dc && l2) dc->set_miss_handler(&*l2);
   if (ic) ic->set_log(log_cache);
@@ -177,11 +201,13 @@ int main(int argc, char** argv)
   {
     if (ic) s.get_core(i)->get_mmu()->register_memtracer(&*ic);
     if (dc) s.get_core(i)->get_mmu()->register_memtracer(&*dc);
+    if (tlb_sets) s.get_core(i)->get_mmu()->configure_page_tlb(tlb_sets, tlb_ways);
     if (extension) s.get_core(i)->register_extension(extension());
   }
 
   s.set_debug(debug);
   s.set_log(log);
   s.set_histogram(histogram);
+  s.set_parallel(parallel);
   return s.run();
 }
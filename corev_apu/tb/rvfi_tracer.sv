@@ -7,6 +7,11 @@
 //
 // Original Author: Jean-Roch COULON (jean-roch.coulon@invia.fr)
 
+`ifdef VERILATOR
+// lets the Verilator harness start waveform dumping at a committed PC
+import "DPI-C" function void rvfi_commit(input longint pc);
+`endif
+
 module rvfi_tracer #(
   parameter logic [7:0] HART_ID      = '0,
   parameter int unsigned DEBUG_START = 0,
@@ -35,6 +40,9 @@ module rvfi_tracer #(
       pc64 = {{riscv::XLEN-riscv::VLEN{rvfi_i[i].pc_rdata[riscv::VLEN-1]}}, rvfi_i[i].pc_rdata};
       // print the instruction information if the instruction is valid or a trap is taken
       if (rvfi_i[i].valid) begin
+`ifdef VERILATOR
+        rvfi_commit(pc64);
+`endif
         // Instruction information
         $fwrite(f, "core   0: 0x%h (0x%h) DASM(%h)\n",
           pc64, rvfi_i[i].insn, rvfi_i[i].insn);